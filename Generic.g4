@@ -33,7 +33,12 @@ comment
     ;
 
 ifStatement
-    : If ifCondition statement (elseStatement)?
+    : frameSkip? If ifCondition statement (elseStatement)?
+    ;
+
+/* Only evaluate the condition every n frames (n = 1, 2, 4, ..., 64). */
+frameSkip
+    : Every '(' numericLiteral ')'
     ;
 
 ifCondition
@@ -149,6 +154,7 @@ actorReference
 
 literal
     : NullLiteral
+    | BooleanLiteral
     | StringLiteral
     | numericLiteral
     ;
@@ -200,6 +206,7 @@ reservedWord
 keyword
     : If
     | Else
+    | Every
     | Self
     ;
 
@@ -226,6 +233,7 @@ field
 /* Keyword */
 If      : 'if';
 Else    : 'else';
+Every   : 'every';
 Self    : ('self' | 'this');
 
 /* Field */
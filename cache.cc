@@ -0,0 +1,192 @@
+//
+//  cache.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-18.
+//
+
+#include "cache.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+// Bump when the layout of an entry changes. Changes to the compiler's output are covered
+// by CPASCPT_OUTPUT_VERSION, which is part of the hash.
+#define CACHE_VERSION 3
+#define CACHE_MAGIC 0x43504143 // CPAC
+
+static uint64_t hashBytes(const void* data, size_t length, uint64_t hash = 0xCBF29CE484222325ull)
+{
+    // FNV-1a
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+template <typename T>
+static void put(std::string& out, T value)
+{
+    out.append((const char*)&value, sizeof(T));
+}
+
+static void putString(std::string& out, const std::string& str)
+{
+    put<uint32_t>(out, uint32_t(str.length()));
+    out.append(str);
+}
+
+template <typename T>
+static bool get(std::istream& in, T& value)
+{
+    return bool(in.read((char*)&value, sizeof(T)));
+}
+
+static bool getString(std::istream& in, std::string& str)
+{
+    uint32_t length = 0;
+    if (!get(in, length) || length > (1u << 20)) return false;
+    str.resize(length);
+    return bool(in.read(&str[0], length));
+}
+
+CompileCache::CompileCache(const std::filesystem::path& directory) : directory(directory)
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+}
+
+std::filesystem::path CompileCache::entryPath(const CompilerContext& compiler, std::string_view source, uint64_t& hash)
+{
+    uint32_t header[4] = { CACHE_VERSION, CPASCPT_OUTPUT_VERSION, uint32_t(compiler.target), uint32_t(compiler.options) };
+    hash = hashBytes(header, sizeof(header));
+    hash = hashBytes(source.data(), source.size(), hash);
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.cpac", (unsigned long long)hash);
+    return directory / name;
+}
+
+bool CompileCache::load(CompilerContext& compiler, std::string_view source, NodeTree& tree)
+{
+    uint64_t hash;
+    std::ifstream file(entryPath(compiler, source, hash), std::ios_base::binary);
+    if (!file.is_open()) return false;
+
+    uint32_t magic = 0, version = 0, target = 0;
+    uint64_t storedHash = 0, storedLength = 0;
+    if (!get(file, magic) || magic != CACHE_MAGIC) return false;
+    if (!get(file, version) || version != CACHE_VERSION) return false;
+    if (!get(file, target) || target != uint32_t(compiler.target)) return false;
+    if (!get(file, storedHash) || storedHash != hash) return false;
+    if (!get(file, storedLength) || storedLength != source.size()) return false;
+
+    // Every name must resolve as it did when the entry was stored.
+    uint32_t numSymbols = 0;
+    if (!get(file, numSymbols)) return false;
+    while (numSymbols--)
+    {
+        uint8_t kind = 0;
+        uint32_t address = 0;
+        std::string actor, name;
+        if (!get(file, kind) || !getString(file, actor) || !getString(file, name) || !get(file, address)) return false;
+
+        uint32_t current = kind == ResolvedSymbol::Actor
+            ? (compiler.callbackFindActor ? compiler.callbackFindActor(name.c_str()) : 0)
+            : (compiler.callbackFindSubroutine ? compiler.callbackFindSubroutine(actor.c_str(), name.c_str()) : 0);
+        if (current != address) return false;
+    }
+
+    uint32_t numNodes = 0;
+    std::string strings;
+    if (!get(file, numNodes) || numNodes > (1u << 26)) return false;
+
+    std::vector<Node> nodes(numNodes);
+    if (!file.read((char*)nodes.data(), numNodes * sizeof(Node))) return false;
+    if (!getString(file, strings)) return false;
+
+    // The warnings of the compile, as entries are only stored for compiles without errors.
+    uint32_t numDiagnostics = 0;
+    if (!get(file, numDiagnostics) || numDiagnostics > (1u << 20)) return false;
+
+    std::vector<Diagnostic> diagnostics(numDiagnostics);
+    for (Diagnostic& d : diagnostics)
+    {
+        uint8_t severity = 0;
+        if (!get(file, severity) || !get(file, d.line) || !get(file, d.column) || !getString(file, d.message)) return false;
+        d.severity = Diagnostic::Severity(severity);
+    }
+
+    compiler.diagnostics.swap(diagnostics);
+
+    tree.clear();
+    tree.nodes.swap(nodes);
+    tree.strings.swap(strings);
+    tree.invalidate();
+
+    // Rebuild the intern table, so further strings are still deduplicated.
+    for (size_t offset = 0; offset < tree.strings.size(); )
+    {
+        std::string text(tree.strings.c_str() + offset);
+        tree.stringOffsets.emplace(text, uint32_t(offset));
+        offset += text.length() + 4 - (text.length() % 4);
+    }
+
+    return true;
+}
+
+void CompileCache::store(const CompilerContext& compiler, std::string_view source, const NodeTree& tree)
+{
+    uint64_t hash;
+    std::filesystem::path path = entryPath(compiler, source, hash);
+
+    std::string data;
+    put<uint32_t>(data, CACHE_MAGIC);
+    put<uint32_t>(data, CACHE_VERSION);
+    put<uint32_t>(data, uint32_t(compiler.target));
+    put<uint64_t>(data, hash);
+    put<uint64_t>(data, source.size());
+
+    put<uint32_t>(data, uint32_t(compiler.resolvedSymbols.size()));
+    for (const ResolvedSymbol& symbol : compiler.resolvedSymbols)
+    {
+        put<uint8_t>(data, uint8_t(symbol.kind));
+        putString(data, symbol.actor);
+        putString(data, symbol.name);
+        put<uint32_t>(data, symbol.address);
+    }
+
+    put<uint32_t>(data, uint32_t(tree.nodes.size()));
+    data.append((const char*)tree.nodes.data(), tree.nodes.size() * sizeof(Node));
+    putString(data, tree.strings);
+
+    put<uint32_t>(data, uint32_t(compiler.diagnostics.size()));
+    for (const Diagnostic& d : compiler.diagnostics)
+    {
+        put<uint8_t>(data, uint8_t(d.severity));
+        put<uint32_t>(data, d.line);
+        put<uint32_t>(data, d.column);
+        putString(data, d.message);
+    }
+
+    // Write to a temporary file first, so that concurrent readers never see a partial entry.
+    std::stringstream temporaryName;
+    temporaryName << path.filename().string() << "." << std::this_thread::get_id() << ".tmp";
+    std::filesystem::path temporary = directory / temporaryName.str();
+
+    {
+        std::ofstream file(temporary, std::ios_base::binary | std::ios_base::trunc);
+        if (!file.is_open()) return;
+        file.write(data.data(), data.size());
+        if (!file.good()) return;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) std::filesystem::remove(temporary, error);
+}
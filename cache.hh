@@ -0,0 +1,35 @@
+//
+//  cache.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-18.
+//
+
+#ifndef cache_hh
+#define cache_hh
+
+#include <filesystem>
+#include <string>
+
+#include "compile.hh"
+
+// On-disk cache of compiled node trees. Entries are keyed on the hash of the
+// source, the target and the options. Each entry also records the actor and subroutine
+// names the compile resolved, and is only used if all of them still resolve
+// to the same addresses through the compiler's callbacks, as well as the compile's diagnostics.
+struct CompileCache
+{
+    std::filesystem::path directory;
+
+    CompileCache(const std::filesystem::path& directory);
+
+    // Looks up the tree compiled from `source`, and restores the compiler's diagnostics. Returns false on a miss.
+    bool load(CompilerContext& compiler, std::string_view source, NodeTree& tree);
+    // Stores the result of the compiler's last compile of `source`.
+    void store(const CompilerContext& compiler, std::string_view source, const NodeTree& tree);
+
+private:
+    std::filesystem::path entryPath(const CompilerContext& compiler, std::string_view source, uint64_t& hash);
+};
+
+#endif /* cache_hh */
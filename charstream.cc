@@ -0,0 +1,183 @@
+//
+//  charstream.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-26.
+//
+
+#include "charstream.hh"
+
+#if CPASCPT_WITH_ANTLR
+
+using namespace antlr4;
+
+// Code point of a malformed sequence, which is decoded one byte at a time.
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+static bool isASCII(const char* s, size_t n)
+{
+    uint64_t bits = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, s + i, 8);
+        bits |= word;
+    }
+    for (; i < n; i++) bits |= uint8_t(s[i]);
+    return !(bits & 0x8080808080808080ull);
+}
+
+Utf8CharStream::Utf8CharStream(std::string_view source, std::string name) : name(std::move(name))
+{
+    reset(source);
+}
+
+void Utf8CharStream::reset(std::string_view source)
+{
+    this->source = source;
+    current = 0;
+    currentOffset = 0;
+    checkpoints.clear();
+
+    ascii = isASCII(source.data(), source.size());
+    if (ascii)
+    {
+        length = source.size();
+        return;
+    }
+
+    // Count the code points, noting where every CheckpointInterval-th one starts.
+    length = 0;
+    for (size_t offset = 0; offset < source.size(); length++)
+    {
+        if (length % CheckpointInterval == 0) checkpoints.push_back(uint32_t(offset));
+        size_t bytes;
+        decode(offset, bytes);
+        offset += bytes;
+    }
+}
+
+uint32_t Utf8CharStream::decode(size_t offset, size_t& bytes) const
+{
+    const uint8_t* s = (const uint8_t*)source.data() + offset;
+    size_t available = source.size() - offset;
+
+    uint8_t lead = s[0];
+    bytes = 1;
+    if (lead < 0x80) return lead;
+
+    uint32_t codepoint;
+    size_t count;
+    if      ((lead & 0xE0) == 0xC0) { codepoint = lead & 0x1F; count = 2; }
+    else if ((lead & 0xF0) == 0xE0) { codepoint = lead & 0x0F; count = 3; }
+    else if ((lead & 0xF8) == 0xF0) { codepoint = lead & 0x07; count = 4; }
+    else return REPLACEMENT_CHARACTER;
+
+    if (count > available) return REPLACEMENT_CHARACTER;
+    for (size_t i = 1; i < count; i++)
+    {
+        if ((s[i] & 0xC0) != 0x80) return REPLACEMENT_CHARACTER;
+        codepoint = (codepoint << 6) | (s[i] & 0x3F);
+    }
+
+    bytes = count;
+    return codepoint;
+}
+
+size_t Utf8CharStream::offsetOf(size_t index) const
+{
+    if (ascii) return index;
+    if (index >= length) return source.size();
+
+    // Walk forward from the cursor if it is on the way, from the nearest checkpoint otherwise.
+    size_t at, offset;
+    if (index >= current && index - current < CheckpointInterval)
+    {
+        at = current;
+        offset = currentOffset;
+    }
+    else
+    {
+        at = index - index % CheckpointInterval;
+        offset = checkpoints[index / CheckpointInterval];
+    }
+
+    for (size_t bytes; at < index; at++)
+    {
+        decode(offset, bytes);
+        offset += bytes;
+    }
+    return offset;
+}
+
+void Utf8CharStream::consume()
+{
+    if (current >= length) return;
+
+    size_t bytes = 1;
+    if (!ascii) decode(currentOffset, bytes);
+    current++;
+    currentOffset += bytes;
+}
+
+size_t Utf8CharStream::LA(ssize_t i)
+{
+    if (i == 0) return 0;
+
+    ssize_t index = ssize_t(current) + (i > 0 ? i - 1 : i);
+    if (index < 0 || size_t(index) >= length) return IntStream::EOF;
+
+    size_t bytes;
+    if (ascii) return uint8_t(source[size_t(index)]);
+    if (i == 1) return decode(currentOffset, bytes);
+    return decode(offsetOf(size_t(index)), bytes);
+}
+
+ssize_t Utf8CharStream::mark()
+{
+    // The whole source is always available.
+    return -1;
+}
+
+void Utf8CharStream::release(ssize_t marker)
+{
+}
+
+size_t Utf8CharStream::index()
+{
+    return current;
+}
+
+void Utf8CharStream::seek(size_t index)
+{
+    if (index > length) index = length;
+    currentOffset = offsetOf(index);
+    current = index;
+}
+
+size_t Utf8CharStream::size()
+{
+    return length;
+}
+
+std::string Utf8CharStream::getSourceName() const
+{
+    return name;
+}
+
+std::string Utf8CharStream::getText(const misc::Interval& interval)
+{
+    if (interval.a < 0 || interval.b < interval.a || size_t(interval.a) >= length) return std::string();
+
+    size_t start = offsetOf(size_t(interval.a));
+    size_t stop = offsetOf(std::min(size_t(interval.b) + 1, length));
+    return std::string(source.substr(start, stop - start));
+}
+
+std::string Utf8CharStream::toString() const
+{
+    return std::string(source);
+}
+
+#endif /* CPASCPT_WITH_ANTLR */
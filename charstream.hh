@@ -0,0 +1,62 @@
+//
+//  charstream.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-26.
+//
+
+#ifndef charstream_hh
+#define charstream_hh
+
+#include "compile.hh"
+
+#if CPASCPT_WITH_ANTLR
+
+#include <antlr4-runtime.h>
+
+// Character stream over a UTF-8 source, read in place. ANTLRInputStream decodes a copy of the
+// whole source into UTF-32 first; this stream decodes code points as the lexer asks for them.
+// Indices are code points, as ANTLR expects. Sources which are all ASCII are indexed directly,
+// other sources through the byte offset of every 256th code point.
+class Utf8CharStream : public antlr4::CharStream
+{
+public:
+    // The source is borrowed, and must outlive the stream or its next reset.
+    Utf8CharStream(std::string_view source = std::string_view(), std::string name = "<unknown>");
+
+    void reset(std::string_view source);
+
+    void consume() override;
+    size_t LA(ssize_t i) override;
+    ssize_t mark() override;
+    void release(ssize_t marker) override;
+    size_t index() override;
+    void seek(size_t index) override;
+    size_t size() override;
+    std::string getSourceName() const override;
+    std::string getText(const antlr4::misc::Interval& interval) override;
+    std::string toString() const override;
+
+private:
+    static constexpr size_t CheckpointInterval = 256;
+
+    std::string_view source;
+    std::string name;
+    bool ascii = true;
+    // Number of code points
+    size_t length = 0;
+    // Byte offset of every CheckpointInterval-th code point
+    std::vector<uint32_t> checkpoints;
+    // Code point at the cursor, and its byte offset
+    size_t current = 0;
+    size_t currentOffset = 0;
+
+    // Decodes the code point at a byte offset, and its length in bytes.
+    uint32_t decode(size_t offset, size_t& bytes) const;
+    // Byte offset of a code point; `length` maps to the end of the source.
+    size_t offsetOf(size_t index) const;
+};
+
+#endif /* CPASCPT_WITH_ANTLR */
+
+#endif /* charstream_hh */
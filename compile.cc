@@ -6,8 +6,18 @@
 //
 
 #include "compile.hh"
-#include "types-r3.hh"
+#include "symbols.hh"
+#include "optimize.hh"
+#include "typecheck.hh"
 
+#include "parse.hh"
+#include "charstream.hh"
+#include "mappedfile.hh"
+
+#include <algorithm>
+#include <cerrno>
+
+#if CPASCPT_WITH_ANTLR
 #include <antlr4-runtime.h>
 
 #include "GenericLexer.h"
@@ -24,43 +34,23 @@ private:
     bool dotAccess = false;
     
     std::string targetActorName = "Rayman";
-    std::string errorString = "No error";
     
+    // Records an error and carries on, so that all errors of a source are reported in one compile.
     void fail(ParserRuleContext* ctx, std::string reason)
     {
-        std::stringstream stream;
-        stream << "Line " << ctx->start->getLine() << ":" << ctx->start->getCharPositionInLine() << ": " << reason << "\n";
-        errorString = stream.str();
-        
-        if (!(compiler->options & CompilerContext::IgnoreAllErrors))
-        {
-            std::cerr << errorString;
-            exit(-1);
-        }
-    }
-    
-    long tableFindSymbol(std::vector<std::string> table, std::string symbol)
-    {
-        auto iter = std::find(table.begin(), table.end(), symbol);
-        if (iter != table.end()) return iter - table.begin();
-        return -1;
+        unsigned line = ctx->start ? unsigned(ctx->start->getLine()) : 0;
+        unsigned column = ctx->start ? unsigned(ctx->start->getCharPositionInLine()) : 0;
+        compiler->report(Diagnostic::Error, line, column, reason);
     }
     
-    uint32_t findSubroutine(std::string name)
+    uint32_t findSubroutine(const std::string& name)
     {
-        return compiler->callbackFindSubroutine ?
-        compiler->callbackFindSubroutine(targetActorName.c_str(), name.c_str()) : 0;
+        return compiler->findSubroutine(targetActorName, name);
     }
     
-    uint32_t findActor(std::string name)
+    uint32_t findActor(const std::string& name)
     {
-        return compiler->callbackFindActor ?
-        compiler->callbackFindActor(name.c_str()) : 0;
-    }
-    
-    bool isVectorOp()
-    {
-        return false;
+        return compiler->findActor(name);
     }
     
 public:
@@ -70,11 +60,6 @@ public:
         compiler = c;
     }
     
-    std::string getErrorMessage()
-    {
-        return errorString;
-    }
-    
     void enterStatement(GenericParser::StatementContext * ctx) override { }
     void exitStatement(GenericParser::StatementContext * ctx) override { }
 
@@ -90,7 +75,23 @@ public:
     void enterIfStatement(GenericParser::IfStatementContext * ctx) override
     {
         if (!ctx->ifCondition()) fail(ctx, "Missing condition in if-statement");
-        compiler->makeNode(NodeType::KeyWord, 0u /* If */);
+        
+        unsigned keyword = 0 /* If */;
+        if (GenericParser::FrameSkipContext *frameSkip = ctx->frameSkip())
+        {
+            // every(1) is a plain If, every(2) to every(64) are If2 to If64.
+            std::string interval = frameSkip->numericLiteral() ? frameSkip->numericLiteral()->getText() : "";
+            if      (interval ==  "1") keyword = 0;
+            else if (interval ==  "2") keyword = 2;
+            else if (interval ==  "4") keyword = 3;
+            else if (interval ==  "8") keyword = 4;
+            else if (interval == "16") keyword = 5;
+            else if (interval == "32") keyword = 6;
+            else if (interval == "64") keyword = 7;
+            else fail(frameSkip, "Invalid frame interval '" + interval + "': must be one of 1, 2, 4, 8, 16, 32 or 64");
+        }
+        
+        compiler->makeNode(NodeType::KeyWord, keyword);
         compiler->shiftDepth(+1);
     }
     
@@ -99,6 +100,9 @@ public:
         compiler->shiftDepth(-1);
     }
     
+    void enterFrameSkip(GenericParser::FrameSkipContext * ctx) override { }
+    void exitFrameSkip(GenericParser::FrameSkipContext * ctx) override { }
+    
     void exitIfCondition(GenericParser::IfConditionContext * ctx) override
     {
         compiler->shiftDepth(-1);
@@ -120,29 +124,31 @@ public:
     {
         GenericParser::FunctionNameContext *nameCtx = ctx->functionName();
         if (!nameCtx)
+        {
             fail(ctx, "Missing callable method name");
+            compiler->shiftDepth(+1);
+            return;
+        }
         
         std::string name = nameCtx->getText();
         
-        long functionIndex = tableFindSymbol(compiler->functionTable, name);
-        long procedureIndex = tableFindSymbol(compiler->procedureTable, name);
-        long conditionIndex = tableFindSymbol(compiler->conditionTable, name);
-        long metaActionIndex = tableFindSymbol(compiler->metaActionTable, name);
+        const Symbol* symbol = compiler->findSymbol(name);
+        uint8_t table = symbol ? symbol->table : 0xFF;
         
         uint32_t subroutine = 0;
-        if      (functionIndex   >= 0) compiler->makeNode(NodeType::Function, unsigned(functionIndex));
-        else if (procedureIndex  >= 0) compiler->makeNode(NodeType::Procedure, unsigned(procedureIndex));
-        else if (conditionIndex  >= 0) compiler->makeNode(NodeType::Condition, unsigned(conditionIndex));
-        else if (metaActionIndex >= 0) compiler->makeNode(NodeType::MetaAction, unsigned(metaActionIndex));
+        if      (table == SymbolTable_Function)   compiler->makeNode(NodeType::Function, compiler->symbolIndex(symbol));
+        else if (table == SymbolTable_Procedure)  compiler->makeNode(NodeType::Procedure, compiler->symbolIndex(symbol));
+        else if (table == SymbolTable_Condition)  compiler->makeNode(NodeType::Condition, compiler->symbolIndex(symbol));
+        else if (table == SymbolTable_MetaAction) compiler->makeNode(NodeType::MetaAction, compiler->symbolIndex(symbol));
         else if ((subroutine = findSubroutine(name)) != 0) compiler->makeNode(NodeType::SubRoutine, subroutine);
         else fail(ctx, "No such callable method '" + name + "' found");
         
         if (subroutine != 0)
         {
             // Make sure only procedures can be called within actor reference access.
-            if (this->dotAccess && functionIndex   >= 0) fail(ctx, "Cannot call function '" + name + "' on actor reference");
-            if (this->dotAccess && conditionIndex  >= 0) fail(ctx, "Cannot call condition '" + name + "' on actor reference");
-            if (this->dotAccess && metaActionIndex >= 0) fail(ctx, "Cannot call meta-action '" + name + "' on actor reference");
+            if (this->dotAccess && table == SymbolTable_Function)   fail(ctx, "Cannot call function '" + name + "' on actor reference");
+            if (this->dotAccess && table == SymbolTable_Condition)  fail(ctx, "Cannot call condition '" + name + "' on actor reference");
+            if (this->dotAccess && table == SymbolTable_MetaAction) fail(ctx, "Cannot call meta-action '" + name + "' on actor reference");
             //if (this->dotAccess && subroutine >= 0) fail(ctx, "Cannot call meta-action '" + name + "' on actor reference");
         }
         
@@ -170,17 +176,12 @@ public:
         if (arithmeticOperator)
         {
             std::string op = arithmeticOperator->getText();
-            if (op == "+") compiler->makeNode(NodeType::Operator, isVectorOp() ? 17u : 0u);
-            else if (op == "-") compiler->makeNode(NodeType::Operator, isVectorOp() ? 18u : 1u);
-            else if (op == "*") compiler->makeNode(NodeType::Operator, isVectorOp() ? 20u : 2u);
-            else if (op == "/") compiler->makeNode(NodeType::Operator, isVectorOp() ? 21u : 3u);
-            else if (op == "%")
-            {
-                if (isVectorOp())
-                    fail(ctx, "Modulo operation '%' cannot be performed on a vector operand");
-                else
-                    compiler->makeNode(NodeType::Operator, 5);
-            }
+            // Vector arithmetic is selected by the type check once the operands are known.
+            if (op == "+") compiler->makeNode(NodeType::Operator, 0u);
+            else if (op == "-") compiler->makeNode(NodeType::Operator, 1u);
+            else if (op == "*") compiler->makeNode(NodeType::Operator, 2u);
+            else if (op == "/") compiler->makeNode(NodeType::Operator, 3u);
+            else if (op == "%") compiler->makeNode(NodeType::Operator, 5u);
             else fail(ctx, "Invalid arithmetic operator '" + op + "'");
             
             compiler->shiftDepth(+1);
@@ -188,8 +189,6 @@ public:
         
         if (comparisonOperator)
         {
-            if (isVectorOp()) fail(ctx, "Attempt to perform comparison on vector operand");
-            
             std::string op = comparisonOperator->getText();
             if      (op == "==") compiler->makeNode(NodeType::Condition, 4u);
             else if (op == "!=") compiler->makeNode(NodeType::Condition, 5u);
@@ -204,8 +203,6 @@ public:
         
         if (logicalOperator)
         {
-            if (isVectorOp()) fail(ctx, "Attempt to perform logical operation on vector operand");
-            
             std::string op = logicalOperator->getText();
             if (op == "&&") compiler->makeNode(NodeType::Condition, 0u);
             else if (op == "||") compiler->makeNode(NodeType::Condition, 1u);
@@ -220,12 +217,8 @@ public:
         {
             std::string op = unaryOperator->getText();
             if      (op == "+") /* Do nothing */;
-            else if (op == "-") compiler->makeNode(NodeType::Operator, isVectorOp() ? 19u : 4u);
-            else if (op == "!")
-            {
-                if (isVectorOp()) fail(ctx, "Attempt to perform logical operation on vector operand");
-                compiler->makeNode(NodeType::Condition, 2u /* ! */);
-            }
+            else if (op == "-") compiler->makeNode(NodeType::Operator, 4u);
+            else if (op == "!") compiler->makeNode(NodeType::Condition, 2u /* ! */);
             else fail(ctx, "Invalid unary operator '" + op + "'");
             
             compiler->shiftDepth(+1);
@@ -313,9 +306,17 @@ public:
 
     void enterDsgVar(GenericParser::DsgVarContext * ctx) override
     {
-        if (!ctx->numericLiteral()) fail(ctx, "DsgVar is missing numeric identifier");
-        unsigned id = std::stoi(ctx->numericLiteral()->getText());
-        compiler->makeNode(NodeType::DsgVarRef2, id);
+        if (!ctx->numericLiteral()) return fail(ctx, "DsgVar is missing numeric identifier");
+        
+        try
+        {
+            unsigned id = std::stoi(ctx->numericLiteral()->getText());
+            compiler->makeNode(NodeType::DsgVarRef2, id);
+        }
+        catch (const std::exception&)
+        {
+            fail(ctx, "Invalid dsgvar identifier '" + ctx->numericLiteral()->getText() + "'");
+        }
     }
     
     void exitDsgVar(GenericParser::DsgVarContext * ctx) override { }
@@ -339,10 +340,17 @@ public:
         if (ctx->numericLiteral())
         {
             std::string num = ctx->getText();
-            if (num.find('.') != std::string::npos)
-                compiler->makeNode(NodeType::Real, std::stof(num));
-            else
-                compiler->makeNode(NodeType::Constant, unsigned(std::stoi(num)));
+            try
+            {
+                if (num.find('.') != std::string::npos)
+                    compiler->makeNode(NodeType::Real, std::stof(num));
+                else
+                    compiler->makeNode(NodeType::Constant, unsigned(std::stoi(num)));
+            }
+            catch (const std::exception&)
+            {
+                fail(ctx, "Numeric literal '" + num + "' is out of range");
+            }
         }
         else if (ctx->StringLiteral())
         {
@@ -350,6 +358,10 @@ public:
             str = str.substr(1, str.length() - 2); // Remove " and \0
             compiler->makeNode(NodeType::String, str);
         }
+        else if (ctx->BooleanLiteral())
+        {
+            compiler->makeBoolean(ctx->getText() == "true");
+        }
     }
     
     void exitLiteral(GenericParser::LiteralContext * ctx) override { }
@@ -370,48 +382,212 @@ public:
     
     void exitField(GenericParser::FieldContext * ctx) override { }
 
-    void enterEveryRule(antlr4::ParserRuleContext * ctx) override { }
+    void enterEveryRule(antlr4::ParserRuleContext * ctx) override
+    {
+        // Nodes are attributed to the innermost rule entered before them.
+        if (ctx->start) compiler->location = SourceLocation { unsigned(ctx->start->getLine()), unsigned(ctx->start->getCharPositionInLine()) };
+    }
+    
     void exitEveryRule(antlr4::ParserRuleContext * ctx) override { }
     void visitTerminal(antlr4::tree::TerminalNode * /*node*/) override { }
     void visitErrorNode(antlr4::tree::ErrorNode * /*node*/) override { }
 };
 
-void CompilerContext::loadTables()
+// Forwards lexer and parser errors to the compiler's diagnostics.
+class SyntaxErrorListener : public BaseErrorListener
 {
-    if (target == Target_R3_GC || target == Target_R3_PC)
+public:
+    CompilerContext* compiler;
+    Diagnostic::Severity severity;
+    
+    SyntaxErrorListener(CompilerContext* c, Diagnostic::Severity s) : compiler(c), severity(s) { }
+    
+    void syntaxError(Recognizer *recognizer, Token *offendingSymbol, size_t line, size_t charPositionInLine, const std::string &msg, std::exception_ptr e) override
     {
-        nodeTypeTable = R3NodeTypes;
-        keywordTable = R3Keywords;
-        operatorTable = R3Operators;
-        functionTable = R3Functions;
-        procedureTable = R3Procedures;
-        conditionTable = R3Conditions;
-        fieldTable = R3Fields;
-        metaActionTable = R3MetaActions;
+        compiler->report(severity, unsigned(line), unsigned(charPositionInLine), msg);
+    }
+};
+
+// Token stream which can drop the tokens already parsed, so that streamed
+// compiles hold the tokens of one statement at a time, not of the whole source.
+class StatementTokenStream : public CommonTokenStream
+{
+public:
+    StatementTokenStream(TokenSource* source) : CommonTokenStream(source) { }
+    
+    // Drops every token before the current one, and renumbers the rest from zero.
+    void discardConsumed()
+    {
+        if (_p == 0 || _p >= _tokens.size()) return;
+        _tokens.erase(_tokens.begin(), _tokens.begin() + _p);
+        _p = 0;
         
-        if (target == Target_R3_GC) // Gamecube adds a function with ID=219.
-            procedureTable.insert(procedureTable.begin() + 219, "FixePositionPersoGamecubeExclusive");
+        for (size_t i = 0; i < _tokens.size(); i++)
+            if (WritableToken* token = dynamic_cast<WritableToken*>(_tokens[i].get())) token->setTokenIndex(i);
+    }
+};
+
+struct CompilerSession
+{
+    Utf8CharStream input;
+    GenericLexer lexer;
+    StatementTokenStream tokens;
+    GenericParser parser;
+    SyntaxErrorListener lexerErrors;
+    SyntaxErrorListener parserErrors;
+    
+    CompilerSession(CompilerContext* compiler) : input(), lexer(&input), tokens(&lexer), parser(&tokens),
+        lexerErrors(compiler, Diagnostic::Warning), parserErrors(compiler, Diagnostic::Error)
+    {
+        // The lexer most likely will generate lots of unnecessary
+        // warnings, so only report them as such. The parser recovers
+        // from syntax errors, and each one is recorded as an error.
+        lexer.removeErrorListeners();
+        lexer.addErrorListener(&lexerErrors);
+        parser.removeErrorListeners();
+        parser.addErrorListener(&parserErrors);
     }
+};
+
+#endif /* CPASCPT_WITH_ANTLR */
+
+static const CompilerTables* loadR3Tables(bool gamecube)
+{
+    CompilerTables* tables = new CompilerTables;
+    tables->nodeTypeTable.assign(std::begin(R3NodeTypes), std::end(R3NodeTypes));
+    tables->keywordTable.assign(std::begin(R3Keywords), std::end(R3Keywords));
+    tables->operatorTable.assign(std::begin(R3Operators), std::end(R3Operators));
+    tables->functionTable.assign(std::begin(R3Functions), std::end(R3Functions));
+    tables->procedureTable.assign(std::begin(R3Procedures), std::end(R3Procedures));
+    tables->conditionTable.assign(std::begin(R3Conditions), std::end(R3Conditions));
+    tables->fieldTable.assign(std::begin(R3Fields), std::end(R3Fields));
+    tables->metaActionTable.assign(std::begin(R3MetaActions), std::end(R3MetaActions));
+    
+    if (gamecube) // Gamecube adds a function with ID=219.
+        tables->procedureTable.insert(tables->procedureTable.begin() + R3GamecubeProcedureIndex, std::string(R3GamecubeProcedure));
+    
+    return tables;
 }
 
-void CompilerContext::compile(std::string source)
+CompilerContext::~CompilerContext()
 {
-    ANTLRInputStream input(source);
+#if CPASCPT_WITH_ANTLR
+    delete session;
+#endif
+    delete parser;
+}
+
+const Symbol* CompilerContext::findSymbol(const std::string& name) const
+{
+    const Symbol* symbol = R3SymbolIndex.find(name);
+    if (symbol && (symbol->flags & SymbolFlag_GamecubeOnly) && target != Target_R3_GC) return nullptr;
+    return symbol;
+}
+
+unsigned CompilerContext::symbolIndex(const Symbol* symbol) const
+{
+    unsigned index = symbol->index;
+    // Gamecube shifts all procedures after its exclusive one up by one.
+    if (target == Target_R3_GC && symbol->table == SymbolTable_Procedure)
+        if (!(symbol->flags & SymbolFlag_GamecubeOnly) && index >= R3GamecubeProcedureIndex) index++;
+    return index;
+}
+
+void CompilerContext::loadTables()
+{
+    static const CompilerTables* R3GCTables = loadR3Tables(true);
+    static const CompilerTables* R3PCTables = loadR3Tables(false);
+    
+    if (target == Target_R3_GC) tables = R3GCTables;
+    if (target == Target_R3_PC) tables = R3PCTables;
+}
+
+void CompilerContext::compile(std::string_view source)
+{
+    if (!tables) this->loadTables();
+    diagnostics.clear();
+    resolvedSymbols.clear();
+    nodeLocations.clear();
+    location = SourceLocation { 1, 0 };
     
-    GenericLexer lexer(&input);
-    // Remove error listeners, as the lexer most likely
-    // will generate lots of unnecessary warnings otherwise.
-    lexer.removeErrorListeners();
+    size_t first = nodetree.nodes.size();
     
-    TreeShapeListener listener;
-    CommonTokenStream tokens(&lexer);
-    GenericParser parser(&tokens);
+#if CPASCPT_WITH_ANTLR
+    if (frontend == Frontend_ANTLR)
+    {
+        if (!session) session = new CompilerSession(this);
+        
+        // Point the existing lexer and parser at the new source. Resetting the
+        // token stream and parser releases the previous parse tree, while the
+        // prediction DFA built by earlier compiles is kept.
+        session->input.reset(source);
+        session->lexer.setInputStream(&session->input);
+        session->tokens.setTokenSource(&session->lexer);
+        session->parser.setTokenStream(&session->tokens);
+        
+        TreeShapeListener listener;
+        listener.setCompiler(this);
+        
+        if (options & Streaming)
+        {
+            // The listener reads each rule's children, so it cannot run during the parse.
+            // Instead, each statement is parsed and walked on its own. Resetting the parser
+            // releases the statement's parse tree, and rewinds the token stream, so the
+            // stream is moved back to the end of the statement, or one token further if
+            // the statement consumed nothing. The tokens before it are no longer referenced,
+            // and are dropped from the stream.
+            while (session->tokens.LA(1) != Token::EOF)
+            {
+                size_t start = session->tokens.index();
+                tree::ParseTree *statement = session->parser.statement();
+                tree::ParseTreeWalker::DEFAULT.walk(&listener, statement);
+                
+                size_t end = std::max(session->tokens.index(), start + 1);
+                session->parser.reset();
+                session->tokens.seek(end);
+                session->tokens.discardConsumed();
+            }
+        }
+        else
+        {
+            tree::ParseTree *tree = session->parser.source();
+            tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+        }
+    }
+    else
+#endif
+    {
+        if (!parser) parser = new NativeParser(this);
+        parser->parse(source);
+    }
+    
+    // A tree with errors may be malformed, so leave it as it is.
+    if (errorCount()) return;
+    
+    // The type check selects the vector operators, so nodes are only final after it.
+    std::vector<ValueType> types;
+    typeCheck(*this, first, types);
+    if (errorCount()) return;
+    
+    if (options & Optimize) optimizeNodeTree(nodetree, first, &types);
+    
+    if (callbackEmitNode)
+        for (size_t i = first; i < nodetree.nodes.size(); i++)
+            callbackEmitNode(nodetree.nodes[i].type, nodetree.nodes[i].param, nodetree.nodes[i].depth);
+}
 
-    listener.setCompiler(this);
-    this->loadTables();
+bool CompilerContext::compileFile(const std::string& path)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        diagnostics.clear();
+        report(Diagnostic::Error, 0, 0, "Cannot open '" + path + "': " + strerror(errno));
+        return false;
+    }
     
-    tree::ParseTree *tree = parser.source();
-    tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+    compile(std::string_view((const char*)file.data, file.size));
+    return true;
 }
 
 #pragma mark - Compiler interoperability
@@ -419,6 +595,7 @@ void CompilerContext::compile(std::string source)
 DLLEXPORT CompilerContext* CPAScriptCompilerCreate(CompilerContext::Target target)
 {
     CompilerContext* c = new CompilerContext(target);
+    c->loadTables();
     return c;
 }
 
@@ -437,9 +614,47 @@ DLLEXPORT void CPAScriptCompilerEmitNodeCallback(CompilerContext* compiler, void
     compiler->callbackEmitNode = callback;
 }
 
+DLLEXPORT void CPAScriptCompilerSetOptions(CompilerContext* compiler, int options)
+{
+    compiler->options = CompilerContext::Options(options);
+}
+
+DLLEXPORT int CPAScriptCompilerSetFrontend(CompilerContext* compiler, int frontend)
+{
+    if (frontend == CompilerContext::Frontend_ANTLR && !CPASCPT_WITH_ANTLR) return -1;
+    if (frontend != CompilerContext::Frontend_ANTLR && frontend != CompilerContext::Frontend_Native) return -1;
+    compiler->frontend = CompilerContext::Frontend(frontend);
+    return 0;
+}
+
 DLLEXPORT int CPAScriptCompilerCompile(CompilerContext* compiler, const char* source)
 {
+    compiler->nodetree.clear();
     compiler->compile(source);
+    return int(compiler->errorCount());
+}
+
+DLLEXPORT int CPAScriptCompilerCompileFile(CompilerContext* compiler, const char* path)
+{
+    compiler->nodetree.clear();
+    if (!compiler->compileFile(path)) return -1;
+    return int(compiler->errorCount());
+}
+
+DLLEXPORT int CPAScriptCompilerDiagnosticCount(CompilerContext* compiler)
+{
+    return int(compiler->diagnostics.size());
+}
+
+DLLEXPORT int CPAScriptCompilerGetDiagnostic(CompilerContext* compiler, int index, int* severity, unsigned* line, unsigned* column, const char** message)
+{
+    if (index < 0 || index >= int(compiler->diagnostics.size())) return -1;
+    
+    const Diagnostic& d = compiler->diagnostics[index];
+    if (severity) *severity = d.severity;
+    if (line) *line = d.line;
+    if (column) *column = d.column;
+    if (message) *message = d.message.c_str();
     return 0;
 }
 
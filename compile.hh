@@ -9,12 +9,79 @@
 #define compile_hh
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <fstream>
 #include <sstream>
 
 #include "nodetree.hh"
 
+// Build the ANTLR front end. Without it, sources are compiled by the native parser only.
+#ifndef CPASCPT_WITH_ANTLR
+#   define CPASCPT_WITH_ANTLR 1
+#endif
+
+// Version of the compiler's output. Bump whenever the nodes compiled from a given source change,
+// so that compile caches stop returning trees built by an earlier compiler.
+#define CPASCPT_OUTPUT_VERSION 5
+
+// Symbol tables of a target, shared by all compiler contexts of that target.
+struct CompilerTables
+{
+    std::vector<std::string> nodeTypeTable;
+    std::vector<std::string> keywordTable;
+    std::vector<std::string> operatorTable;
+    std::vector<std::string> functionTable;
+    std::vector<std::string> procedureTable;
+    std::vector<std::string> conditionTable;
+    std::vector<std::string> fieldTable;
+    std::vector<std::string> metaActionTable;
+};
+
+// Lexer, parser and token stream kept alive between compiles.
+struct CompilerSession;
+class NativeParser;
+struct Symbol;
+
+// An actor or subroutine name resolved through the callbacks during a compile.
+struct ResolvedSymbol
+{
+    enum Kind
+    {
+        Actor,
+        Subroutine,
+    };
+    
+    Kind kind;
+    // Actor in which the subroutine was looked up
+    std::string actor;
+    std::string name;
+    // Address it resolved to, 0 if none
+    uint32_t address;
+};
+
+struct SourceLocation
+{
+    // Line (starting at 1) and column (starting at 0)
+    unsigned line;
+    unsigned column;
+};
+
+struct Diagnostic
+{
+    enum Severity
+    {
+        Error,
+        Warning,
+    };
+    
+    Severity severity;
+    // Line (starting at 1) and column (starting at 0) of the offending source
+    unsigned line;
+    unsigned column;
+    std::string message;
+};
+
 struct CompilerContext
 {
     enum Target
@@ -25,7 +92,22 @@ struct CompilerContext
     
     enum Options
     {
-        IgnoreAllErrors,
+        // No options. Errors are always collected in `diagnostics` and never stop the compiler,
+        // so this keeps its original value of 0, and callers passing it get the default behaviour.
+        IgnoreAllErrors = 0,
+        // Run the optimization passes over the tree of each compile.
+        Optimize        = 1 << 1,
+        // Parse and build the tree one top-level statement at a time, keeping only the parse tree of the
+        // current statement. The native front end always works this way.
+        Streaming       = 1 << 2,
+    };
+    
+    enum Frontend
+    {
+        // Parser generated by ANTLR from Generic.g4
+        Frontend_ANTLR,
+        // Hand-written parser of parse.cc
+        Frontend_Native,
     };
     
     CompilerContext(Target t, Options opt = {})
@@ -34,18 +116,31 @@ struct CompilerContext
         options = opt;
     }
     
+    ~CompilerContext();
+    
+    CompilerContext(const CompilerContext&) = delete;
+    CompilerContext& operator=(const CompilerContext&) = delete;
+    
     // Appends a new node to the tree.
-    void makeNode(NodeType type, std::any param)
+    void makeNode(NodeType type, uint32_t param)
     {
-        Node nd;
+        Node nd {};
         nd.type = type;
         nd.depth = nodetree.depth;
         nd.param = param;
         
-        if (callbackEmitNode)
-            callbackEmitNode(nd.type, std::any_cast<uint32_t>(nd.param), nd.depth);
-        
         nodetree.add(nd);
+        nodeLocations.push_back(location);
+    }
+    
+    void makeNode(NodeType type, float param)
+    {
+        makeNode(type, NodeTree::realBits(param));
+    }
+    
+    void makeNode(NodeType type, const std::string& param)
+    {
+        makeNode(type, nodetree.intern(param));
     }
     
     void shiftDepth(int s)
@@ -53,29 +148,85 @@ struct CompilerContext
         nodetree.depth += s;
     }
     
-    void compile(std::string source);
+    // The engine has no boolean literal: true is compiled as 0 == 0, and false as 0 != 0.
+    void makeBoolean(bool value)
+    {
+        makeNode(NodeType::Condition, value ? 4u /* == */ : 5u /* != */);
+        shiftDepth(+1);
+        makeNode(NodeType::Constant, 0u);
+        makeNode(NodeType::Constant, 0u);
+        shiftDepth(-1);
+    }
+    
+    // Resolves a subroutine of an actor through the callback, recording the result.
+    uint32_t findSubroutine(const std::string& actorName, const std::string& name)
+    {
+        uint32_t address = callbackFindSubroutine ? callbackFindSubroutine(actorName.c_str(), name.c_str()) : 0;
+        resolvedSymbols.push_back(ResolvedSymbol { ResolvedSymbol::Subroutine, actorName, name, address });
+        return address;
+    }
+    
+    // Resolves an actor through the callback, recording the result.
+    uint32_t findActor(const std::string& name)
+    {
+        uint32_t address = callbackFindActor ? callbackFindActor(name.c_str()) : 0;
+        resolvedSymbols.push_back(ResolvedSymbol { ResolvedSymbol::Actor, std::string(), name, address });
+        return address;
+    }
+    
+    // Looks up a symbol in the opcode tables of the current target.
+    const Symbol* findSymbol(const std::string& name) const;
+    // Returns the opcode of a symbol for the current target.
+    unsigned symbolIndex(const Symbol* symbol) const;
+    
+    void report(Diagnostic::Severity severity, unsigned line, unsigned column, std::string message)
+    {
+        diagnostics.push_back(Diagnostic { severity, line, column, message });
+    }
+    
+    unsigned errorCount() const
+    {
+        unsigned count = 0;
+        for (const Diagnostic& d : diagnostics) if (d.severity == Diagnostic::Error) count++;
+        return count;
+    }
+    
+    // Compiles a source string, appending to the node tree. The lexer and parser of the
+    // selected front end are created on the first call and reused by every following one.
+    // Errors are recorded in `diagnostics`; compilation continues past them.
+    // The source is borrowed: the native front end tokenizes it in place, without a copy.
+    void compile(std::string_view source);
+    // Compiles a source file, reading it through a read-only mapping.
+    // Returns false, with an error in `diagnostics`, if the file cannot be opened.
+    bool compileFile(const std::string& path);
     void loadTables();
     
     // Callback to find a subroutine by name. Returned is the address of the actor, 0 if none.
     uint32_t (*callbackFindSubroutine)(const char* actorName, const char* subroutineName) = nullptr;
     // Callback to find an actor by name. Returned is the address of the subroutine, 0 if none.
     uint32_t (*callbackFindActor)(const char* actorName) = nullptr;
-    // Callback to be executed when a node is emitted from the compiler.
+    // Callback to be executed when a node is emitted from the compiler. Nodes are emitted
+    // once a compile has passed the type check and the optimization passes, as they are in
+    // the final tree; a compile with errors emits none.
+    // The parameter of a string node is the offset of its text in the tree's string pool.
     void (*callbackEmitNode)(uint8_t type, uint32_t param, uint8_t depth) = nullptr;
     
     Target target;
     Options options;
+    Frontend frontend = CPASCPT_WITH_ANTLR ? Frontend_ANTLR : Frontend_Native;
     NodeTree nodetree;
+    // Errors and warnings of the last compile
+    std::vector<Diagnostic> diagnostics;
+    // Names the last compile resolved through the callbacks
+    std::vector<ResolvedSymbol> resolvedSymbols;
+    // Source location of each node emitted by the current compile, and of the rule being compiled
+    std::vector<SourceLocation> nodeLocations;
+    SourceLocation location {};
     
-    // Table
-    std::vector<std::string> nodeTypeTable;
-    std::vector<std::string> keywordTable;
-    std::vector<std::string> operatorTable;
-    std::vector<std::string> functionTable;
-    std::vector<std::string> procedureTable;
-    std::vector<std::string> conditionTable;
-    std::vector<std::string> fieldTable;
-    std::vector<std::string> metaActionTable;;
+    // Tables of the current target, loaded once per process.
+    const CompilerTables* tables = nullptr;
+    CompilerSession* session = nullptr;
+    NativeParser* parser = nullptr;
 };
 
 #pragma mark - Compiler interoperability
@@ -86,7 +237,8 @@ struct CompilerContext
 #   define DLLEXPORT
 #endif
 
-// Create a new compiler context
+// Create a new compiler context. The context keeps its tables and parser state
+// between compiles, so it should be reused for as many sources as possible.
 DLLEXPORT CompilerContext* CPAScriptCompilerCreate(CompilerContext::Target target);
 // Register callback for finding actor offets
 DLLEXPORT void CPAScriptCompilerFindActorCallback(CompilerContext* compiler, uint32_t (*callback)(const char*));
@@ -94,8 +246,18 @@ DLLEXPORT void CPAScriptCompilerFindActorCallback(CompilerContext* compiler, uin
 DLLEXPORT void CPAScriptCompilerFindMacroCallback(CompilerContext* compiler, uint32_t (*callback)(const char*, const char*));
 // Register callback for when the compiler emits a new node
 DLLEXPORT void CPAScriptCompilerEmitNodeCallback(CompilerContext* compiler, void (*callback)(uint8_t, uint32_t, uint8_t));
-// Compile source string
+// Set compiler options, a combination of CompilerContext::Options
+DLLEXPORT void CPAScriptCompilerSetOptions(CompilerContext* compiler, int options);
+// Select the front end, a CompilerContext::Frontend. Returns -1 if it was not built in.
+DLLEXPORT int CPAScriptCompilerSetFrontend(CompilerContext* compiler, int frontend);
+// Compile source string, replacing the result of the previous compile. Returned is the number of errors.
 DLLEXPORT int CPAScriptCompilerCompile(CompilerContext* compiler, const char* source);
+// Compile source file, replacing the result of the previous compile. Returned is the number of errors, -1 if the file cannot be opened.
+DLLEXPORT int CPAScriptCompilerCompileFile(CompilerContext* compiler, const char* path);
+// Number of errors and warnings reported by the last compile
+DLLEXPORT int CPAScriptCompilerDiagnosticCount(CompilerContext* compiler);
+// Get a diagnostic of the last compile. Severity is 0 for errors and 1 for warnings. Returns -1 if the index is out of range.
+DLLEXPORT int CPAScriptCompilerGetDiagnostic(CompilerContext* compiler, int index, int* severity, unsigned* line, unsigned* column, const char** message);
 // Destroy compiler context
 DLLEXPORT void CPAScriptCompilerDestroy(CompilerContext *c);
 
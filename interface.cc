@@ -6,252 +6,151 @@
 //
 
 #include "interface.hh"
+#include "parallel.hh"
 
-#include <fstream>
-#include <sstream>
 #include <memory>
 #include <iostream>
 
 #pragma mark - Memory
 
-#define ptrReadFn std::function<void (std::fstream &)> 
-
+// Reads a value in game byte order at the cursor.
 template <typename T>
-class ReadResult
+static T read(MappedStream& stream)
 {
-public:
-    T data;
-    unsigned readOffset = 0;
-    std::fstream stream;
-    
-    ReadResult(T type, long readOffset = 0) : data(type), readOffset(readOffset)
-    {
-//        if (std::is_same<T, pointer>::value) // Read pointer
-//        {
-//            std::pair<pointer, uint8_t> pair = level->pointers[readOffset - 4];
-//            pointer pointer = pair.first;
-//            uint8_t fileID = pair.second;
-//            data = pointer;
-//        }
-    }
-
-    operator T() const { return data; }
-    T swap()
-    {
-        switch (sizeof(T))
-        {
-            case 1: return data;
-            case 2: return swap16(data);
-            case 4: return swap32(data);
-            default: return data;
-        }
-    }
-    
-    T doAt(Level *level, std::function<void(std::fstream&, uint8_t)>&& callback)
-    {
-        std::pair<pointer, uint8_t> pair = level->pointers[readOffset];
-        pointer pointer = pair.first;
-        uint8_t fileID = pair.second;
-        
-        if (pointer != 0 && fileID < 2) // >= 2: kf, vb
-        {
-            // Go to the level the pointer points to
-            Level* lvl = level->interface->level[fileID];
-            // Get the stream handle of the level buffer
-            std::fstream& stream = lvl->levelFile;
-            // Save position
-            auto checkpoint = stream.tellg();
-            // Read at pointer
-            stream.seekg(pointer);
-            callback(stream, fileID);
-            // Seek back
-            stream.seekg(checkpoint);
-        }
-        
-        return data;
-    }
-    
-    T doAt(Level *level, std::function<void(std::fstream&)>&& callback)
-    {
-        return doAt(level, std::function<void (std::fstream &, uint8_t)> ([callback](std::fstream& stream, uint8_t) { callback(stream); }));
-    }
-    
-    T* dynamic()
-    {
-        T *dyn = new T{};
-        memcpy(dyn, &data, sizeof(T));
-        return dyn;
-    }
-};
+    uint8_t bytes[sizeof(T)];
+    stream.read(bytes, sizeof(T));
+    return loadGame<T>(bytes);
+}
 
-template <typename T>
-static ReadResult<T> read(std::fstream& file)
+// View of the structure at a level's read cursor.
+template <typename Layout>
+static View<Layout> viewAt(Level* level)
 {
-    T data {};
-    uint32_t offset = file.tellg();
-    file.read((char*)&data, sizeof(T));
-    return ReadResult<T>(data, offset);
+    return View<Layout>(&level->interface->memory, level->isFix ? 0 : 1, uint32_t(level->levelStream.tellg()));
 }
 
 #pragma mark - Level
 
-Level::Level(GameInterface* interface, std::fstream& lvl, std::fstream& ptr, bool isFix) : levelFile(lvl), pointerFile(ptr), isFix(isFix)
+Level::Level(GameInterface* interface, MappedFile& lvl, MappedFile& ptr, bool isFix) : levelFile(lvl), pointerFile(ptr), isFix(isFix)
 {
     this->interface = interface;
     
-    uint32_t numPointers = read<uint32_t>(ptr).swap();
+    levelStream = lvl.at(0);
+    pointerStream = ptr.at(0);
+}
+
+void Level::ReadPointers()
+{
+    uint32_t numPointers = read<uint32_t>(pointerStream);
+    pointers.reserve(numPointers);
     while (numPointers--)
     {
-        uint32_t fileID = read<uint32_t>(ptr).swap();
-        doublepointer doublePointer = read<doublepointer>(ptr).swap() + 4;
-        // Seek to the pointed location
-        lvl.seekg(doublePointer);
-        // Read the pointer at the location
-        pointer resultingPointer = read<pointer>(lvl).swap() + 4;
+        uint32_t fileID = read<uint32_t>(pointerStream);
+        doublepointer doublePointer = read<doublepointer>(pointerStream) + 4;
+        // Read the pointer at the pointed location
+        MappedStream stream = levelFile.at(doublePointer);
+        pointer resultingPointer = read<pointer>(stream) + 4;
         
-        pointers[doublePointer] = std::make_pair(resultingPointer, fileID);
+        pointers.add(doublePointer, resultingPointer, fileID);
     }
-    
-    lvl.seekg(0);
 }
 
 void Level::ReadFillInPointers()
 {
-    auto checkpoint = pointerFile.tellg();
-    pointerFile.seekg(0, pointerFile.end);
-    long size = pointerFile.tellg();
-    pointerFile.seekg(checkpoint);
+    long size = long(pointerFile.size);
+    long position = long(pointerStream.tellg());
     
-    uint32_t numFillInPointers = unsigned((size - pointerFile.tellg()) / 16);
+    uint32_t numFillInPointers = position < size ? unsigned((size - position) / 16) : 0;
     while (numFillInPointers--)
     {
-        uint32_t doublePointer = read<uint32_t>(pointerFile).swap();
-        uint32_t sourceFile = read<uint32_t>(pointerFile).swap();
-        pointer realPointer = read<pointer>(pointerFile).swap();
-        uint32_t targetFile = read<uint32_t>(pointerFile).swap();
+        uint32_t doublePointer = read<uint32_t>(pointerStream);
+        uint32_t sourceFile = read<uint32_t>(pointerStream);
+        pointer realPointer = read<pointer>(pointerStream);
+        uint32_t targetFile = read<uint32_t>(pointerStream);
         
         if (sourceFile < 2 && targetFile < 2)
         {
             //printf("%d (%d) -> %d (%d)\n", doublePointer, sourceFile, realPointer, targetFile);
-            this->interface->level[sourceFile]->pointers[doublePointer] = std::make_pair(realPointer, targetFile);
+            this->interface->level[sourceFile]->pointers.add(doublePointer, realPointer, targetFile);
         }
     }
 }
 
-template <typename T>
-static void ReadIntelligence(Level *level, std::fstream& stream, std::vector<T>& list, bool isMacro = false)
+template <typename List, typename T>
+static void ReadScripts(View<List> list, std::vector<T>& scripts)
 {
-    auto checkpoint = stream.tellg();
+    if (!list) return;
     
-    read<pointer>(stream).doAt(level, ptrReadFn([level, &list, isMacro](std::fstream& listStream) {
-        // Save position
-        auto savepoint = listStream.tellg();
-        // Skip first macro pointer
-        listStream.ignore(4);
-        // Read macro count
-        uint32_t count = isMacro ? read<uint8_t>(listStream).swap() : read<uint32_t>(listStream).swap();
-        // Seek back
-        listStream.seekg(savepoint);
-        // Read the macros
-        read<pointer>(listStream).doAt(level, ptrReadFn([level, &list, count, isMacro](std::fstream& typeStream) {
-            for (unsigned int i = 0; i < count; i++) {
-                
-                uint32_t offset = typeStream.tellg();
-                
-                char* buf = new char[0x100];
-                typeStream.read(buf, 0x100);
-                std::string name(buf);
-                delete[] buf;
-                
-                name = name.substr(name.find(':') + 1);
-                
-                T readtype;
-                readtype.name = name;
-                readtype.offset = offset;
-                list.push_back(readtype);
-                
-                typeStream.ignore(isMacro ? 8 : 12);
-            }
-        }));
-    }));
+    uint32_t count = list.template get<typename List::count>();
+    auto entries = list.template follow<typename List::entries>();
+    if (!entries) return;
     
-    stream.seekg(long(checkpoint) + 4);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto entry = entries[i];
+        std::string_view name = entry.template text<typename List::entries::target::name>();
+        
+        T script;
+        script.name = name.substr(name.find(':') + 1);
+        script.offset = entry.offset;
+        scripts.push_back(script);
+    }
 }
 
-void Level::ReadActor(std::fstream& stream, uint8_t fileID)
+static void ReadActorAI(View<R3::Actor> view, Actor& actor)
 {
-    //auto savepoint = stream.tellg();
-    
-    Actor actor;
-    actor.offset = stream.tellg();
-    actor.fileID = fileID;
-    
-    stream.ignore(4); // Skip 3DData
-    read<pointer>(stream).doAt(this, ptrReadFn([this, &actor](std::fstream& stdGameStream) {
-        // Inside stdgame struct
-        actor.familyType = read<uint32_t>(stdGameStream).swap();
-        actor.modelType = read<uint32_t>(stdGameStream).swap();
-        actor.instanceType = read<uint32_t>(stdGameStream).swap();        
-    }));
+    View<R3::AIModel> model = view.follow<R3::Actor::brain>().follow<R3::Brain::mind>().follow<R3::Mind::aiModel>();
+    if (model)
+    {
+        ReadScripts(model.follow<R3::AIModel::intelligence>(), actor.intelligenceList);
+        ReadScripts(model.follow<R3::AIModel::reflex>(), actor.reflexList);
+        ReadScripts(model.follow<R3::AIModel::macros>(), actor.macroList);
+    }
     
-    stream.ignore(4); // Skip dynamics
-    read<pointer>(stream).doAt(this, ptrReadFn([this, &actor](std::fstream& brainStream) {
-        // Inside brain struct
-        read<pointer>(brainStream).doAt(this, ptrReadFn([this, &actor](std::fstream& mindStream) {
-            // Inside mind struct
-            read<pointer>(mindStream).doAt(this, ptrReadFn([this, &actor](std::fstream& AIModelStream) {
-                // Inside AIModel struct
-                // Skip intelligence, reflex and dsgvars
-                AIModelStream.ignore(0);
-                
-                std::vector<Behavior> intelligenceList;
-                std::vector<Behavior> reflexList;
-                std::vector<Macro> macroList;
-                
-                ReadIntelligence(this, AIModelStream, actor.intelligenceList);
-                ReadIntelligence(this, AIModelStream, actor.reflexList);
-                AIModelStream.ignore(4); // Skip dsgvars
-                ReadIntelligence(this, AIModelStream, actor.macroList, true);
-            }));
-        }));
-    }));
+    actor.aiLoaded = true;
+}
+
+static void ReadActor(View<R3::Actor> view, Actor& actor, bool lazy)
+{
+    actor.offset = view.offset;
+    actor.fileID = view.file;
     
-    this->interface->actors.push_back(actor);
+    if (View<R3::StdGame> stdGame = view.follow<R3::Actor::stdGame>())
+    {
+        actor.familyType = stdGame.get<R3::StdGame::familyType>();
+        actor.modelType = stdGame.get<R3::StdGame::modelType>();
+        actor.instanceType = stdGame.get<R3::StdGame::instanceType>();
+    }
     
-    //stream.seekg(savepoint);
+    // Behaviours and macros are read on first use in lazy mode.
+    if (!lazy) ReadActorAI(view, actor);
 }
 
-static void ReadObjectType(Level *lvl, std::fstream& stream, std::vector<std::string>& names)
+static void ReadObjectTypes(View<R3::ObjectTypeElement> first, std::vector<std::string_view>& names)
 {
-    auto readtype = [lvl, &names] (std::fstream &elementStream) {
-        elementStream.ignore(12);
-        
-        read<pointer>(elementStream).doAt(lvl, ptrReadFn([lvl, &names](std::fstream& nameStream) {
-            std::stringstream sstream;
-            
-            while (1) {
-                char c = read<char>(nameStream);
-                if (c < 33 || c > 126) break;
-                sstream << std::string(1, c);
-            }
-            
-            std::string name = sstream.str();
-            names.push_back(name);
-        }));
-        
-        elementStream.ignore(4);
+    if (!first) return;
+    
+    // Names which cannot be resolved are left out.
+    auto readName = [&names](View<R3::ObjectTypeElement> element) {
+        if (View<R3::ObjectTypeName> name = element.follow<R3::ObjectTypeElement::name>())
+            names.push_back(name.word());
     };
     
-    readtype(stream);
-    while (1) {
-        if (read<ObjectTypeElement>(stream).doAt(lvl, ptrReadFn([lvl, &names, readtype](std::fstream& elementStream) {
-            readtype(elementStream);
-        })).next == 0) break;
+    // The first element, then the element each following one links to, up to the one which links to none.
+    readName(first);
+    for (uint32_t i = 1;; i++)
+    {
+        View<R3::ObjectTypeElement> element = first[i];
+        readName(element.follow<R3::ObjectTypeElement::next>());
+        if (element.get<R3::ObjectTypeElement::next>() == 0) break;
     }
 }
 
-void Level::Load()
+void Level::ReadHeader()
 {
+    if (headerRead) return;
+    headerRead = true;
+    
     if (isFix)
     {
         // Base + ? + matrix + localization
@@ -259,8 +158,8 @@ void Level::Load()
         // Text
         advance(20);
         
-        uint32_t levelNameCount = read<uint32_t>(levelFile).swap();
-        uint32_t demoNameCount = read<uint32_t>(levelFile).swap();
+        uint32_t levelNameCount = read<uint32_t>(levelStream);
+        uint32_t demoNameCount = read<uint32_t>(levelStream);
         
         // Demo save names
         advance(12 * demoNameCount);
@@ -271,79 +170,97 @@ void Level::Load()
         // Language
         advance(10);
         // Texture count
-        numTextures = read<uint32_t>(levelFile).swap();
+        numTextures = read<uint32_t>(levelStream);
+    }
+    else
+    {
+        // Base + ?
+        advance(4 + 4 * 4);
+        // Text + ?
+        advance(24 + 4 * 60);
+        // Texture count (minus fix texture count)
+        numTextures = read<uint32_t>(levelStream) - interface->level[0]->numTextures;
+    }
+}
+
+void Level::Load()
+{
+    ReadHeader();
+    
+    if (isFix)
+    {
         // Skip textures
         advance(numTextures * 4);
         // Skip menu textures
-        advance(read<uint32_t>(levelFile).swap() * 4);
+        advance(read<uint32_t>(levelStream) * 4);
         // Skip memory channels
         advance(numTextures * 4);
         // Skip input structure (for now)
         advance(0x12E0 + 0x8 + 0x418 + 0xE8);
         
-        uint32_t numActors = read<uint32_t>(levelFile).swap();
+        uint32_t numActors = read<uint32_t>(levelStream);
+        
+        // Collect where each actor starts, then decode them all at once. Each actor is
+        // read through its own view into its own slot, and the pointer tables are only read.
+        View<R3::ActorSlot> slots = viewAt<R3::ActorSlot>(this);
+        advance(numActors * R3::ActorSlot::size);
+        
+        std::vector<View<R3::Actor>> roots;
+        roots.reserve(numActors);
         for (unsigned int n = 0; n < numActors; n++)
         {
-            read<pointer>(levelFile).doAt(this, std::function<void (std::fstream &, uint8_t)> ([this](std::fstream& actorStream, uint8_t fileID) {
-                // Start of actor struct
-                ReadActor(actorStream, fileID);
-            }));
+            if (View<R3::Actor> actor = slots[n].follow<R3::ActorSlot::actor>()) roots.push_back(actor);
         }
         
-        
+        size_t first = interface->actors.size();
+        interface->actors.resize(first + roots.size());
+        parallelFor(roots.size(), parallelWorkerCount(), [this, &roots, first](size_t i, unsigned) {
+            ReadActor(roots[i], interface->actors[first + i], interface->lazy);
+        });
     }
     else
     {
-        // Base + ?
-        advance(4 + 4 * 4);
-        // Text + ?
-        advance(24 + 4 * 60);
-        // Texture count (minus fix texture count)
-        numTextures = read<uint32_t>(levelFile).swap() - interface->level[0]->numTextures;
         // Skip textures
         advance(2 * numTextures * 4);
         
-        //printf("%lld\n", levelFile.tellg().operator long long());
+        //printf("%zu\n", levelStream.tellg());
         
-        pointer actualWorld = read<pointer>(levelFile).swap();
-        pointer dynamicWorld = read<pointer>(levelFile).swap();
-        pointer inactiveDynamicWorld = read<pointer>(levelFile).swap();
-        pointer fatherSector = read<pointer>(levelFile).swap();
-        pointer firstSubmapPosition = read<pointer>(levelFile).swap();
+        pointer actualWorld = read<pointer>(levelStream);
+        pointer dynamicWorld = read<pointer>(levelStream);
+        pointer inactiveDynamicWorld = read<pointer>(levelStream);
+        pointer fatherSector = read<pointer>(levelStream);
+        pointer firstSubmapPosition = read<pointer>(levelStream);
         // Skip until object types
         advance(7 * 4);
         
-        // Family names
-        read<LinkedList>(levelFile).doAt(this, ptrReadFn([this](std::fstream& stream) {
-            ReadObjectType(this, stream, this->interface->familyNames);
-        }));
-        
-        // Model names
-        read<LinkedList>(levelFile).doAt(this, ptrReadFn([this](std::fstream& stream) {
-            ReadObjectType(this, stream, this->interface->modelNames);
-        }));
+        typedef R3::LinkedList<R3::ObjectTypeElement> ObjectTypeList;
+        View<ObjectTypeList> lists = viewAt<ObjectTypeList>(this);
+        advance(3 * ObjectTypeList::size);
         
-        // Instance names
-        read<LinkedList>(levelFile).doAt(this, ptrReadFn([this](std::fstream& stream) {
-            ReadObjectType(this, stream, this->interface->instanceNames);
-        }));
+        // Family, model and instance names
+        ReadObjectTypes(lists[0].follow<ObjectTypeList::start>(), interface->familyNames);
+        ReadObjectTypes(lists[1].follow<ObjectTypeList::start>(), interface->modelNames);
+        ReadObjectTypes(lists[2].follow<ObjectTypeList::start>(), interface->instanceNames);
     }
 }
 
 void Level::advance(int bytes)
 {
-    levelFile.ignore(bytes);
+    levelStream.ignore(bytes);
 }
 
 void Level::seek(long offset)
 {
-    levelFile.seekg(offset);
+    levelStream.seekg(offset);
 }
 
-GameInterface::GameInterface(std::fstream& fix,
-                             std::fstream& fix_ptr,
-                             std::fstream& lvl,
-                             std::fstream& lvl_ptr)
+GameInterface::GameInterface(MappedFile& fix,
+                             MappedFile& fix_ptr,
+                             MappedFile& lvl,
+                             MappedFile& lvl_ptr,
+                             bool lazy,
+                             const std::string& symbolCache,
+                             PipelineProgress progress) : lazy(lazy), symbolCachePath(symbolCache)
 {
     Level* fixLevel = new Level(this, fix, fix_ptr);
     Level* lvlLevel = new Level(this, lvl, lvl_ptr, false);
@@ -351,107 +268,170 @@ GameInterface::GameInterface(std::fstream& fix,
     level.push_back(fixLevel);
     level.push_back(lvlLevel);
     
-    fixLevel->ReadFillInPointers();
-    lvlLevel->ReadFillInPointers();
+    for (size_t i = 0; i < level.size(); i++)
+    {
+        memory.files[i] = MemoryFile { level[i]->levelFile.data, level[i]->levelFile.size, &level[i]->pointers };
+    }
     
-    fixLevel->Load();
-    lvlLevel->Load();
+    // A warm start reads everything below from the sidecar.
+    if (!symbolCachePath.empty())
+    {
+        Pipeline pipeline;
+        pipeline.progress = progress;
+        bool loaded = false;
+        pipeline.add("symbol cache", {}, [this, &loaded]() { loaded = loadSymbolCache(); });
+        pipeline.run();
+        loadTimings = pipeline.timings;
+        
+        if (loaded)
+        {
+            buildIndex();
+            targetActor = findActor("Rayman");
+            return;
+        }
+    }
     
-    for (Actor& a : actors)
+    // Each level reads its own pointer file. Fill-in pointers may add to either table, so they
+    // are read in order once both tables are, and the tables are sorted only after that.
+    // Of the level data, only the level's texture count depends on the fixed level, on its header.
+    Pipeline pipeline;
+    pipeline.progress = progress;
+    size_t fixPointers = pipeline.add("fix.pointers", {}, [fixLevel]() { fixLevel->ReadPointers(); });
+    size_t lvlPointers = pipeline.add("level.pointers", {}, [lvlLevel]() { lvlLevel->ReadPointers(); });
+    size_t fixHeader = pipeline.add("fix.header", {}, [fixLevel]() { fixLevel->ReadHeader(); });
+    size_t fillIn = pipeline.add("fill-in pointers", { fixPointers, lvlPointers }, [fixLevel, lvlLevel]() {
+        fixLevel->ReadFillInPointers();
+        lvlLevel->ReadFillInPointers();
+    });
+    size_t fixTable = pipeline.add("fix.relocation", { fillIn }, [fixLevel]() { fixLevel->pointers.build(); });
+    size_t lvlTable = pipeline.add("level.relocation", { fillIn }, [lvlLevel]() { lvlLevel->pointers.build(); });
+    size_t fixLoad = pipeline.add("fix.actors", { fixHeader, fixTable }, [fixLevel]() { fixLevel->Load(); });
+    size_t lvlLoad = pipeline.add("level.objects", { fixHeader, lvlTable }, [lvlLevel]() { lvlLevel->Load(); });
+    size_t index = pipeline.add("index", { fixLoad, lvlLoad }, [this]() {
+        for (Actor& a : actors)
+        {
+            a.name = instanceNames.at(a.instanceType);
+        }
+        
+        buildIndex();
+        
+        targetActor = findActor("Rayman");
+    });
+    
+    
+    // The sidecar holds every actor's behaviours and macros, so read them all once now.
+    if (!symbolCachePath.empty())
     {
-        a.name = instanceNames.at(a.instanceType);
+        pipeline.add("symbol cache.write", { index }, [this]() {
+            loadAllActors();
+            storeSymbolCache();
+        });
     }
     
-    targetActor = findActor("Rayman");
+    pipeline.run();
+    loadTimings.insert(loadTimings.end(), pipeline.timings.begin(), pipeline.timings.end());
 }
 
-Actor* GameInterface::findActor(std::string name)
+void GameInterface::buildIndex()
 {
+    actorsByName.reserve(actors.size());
+    actorsByOffset.reserve(actors.size());
+    
+    // Where names repeat, the first actor or macro is kept, as a linear search would find.
     for (Actor& a : actors)
-        if (a.name == name) return &a;
+    {
+        actorsByName.emplace(a.name, &a);
+        actorsByOffset.emplace(a.offset, &a);
+        indexMacros(a);
+    }
+}
+
+void GameInterface::indexMacros(Actor& actor)
+{
+    for (Macro& m : actor.macroList)
+    {
+        macrosByName.emplace(MacroKey { &actor, m.name }, &m);
+        macrosByOffset.emplace(m.offset, &m);
+    }
+}
+
+void GameInterface::loadActor(Actor& actor)
+{
+    if (actor.aiLoaded) return;
     
-    return nullptr;
+    ReadActorAI(View<R3::Actor>(&memory, uint8_t(actor.fileID), actor.offset), actor);
+    indexMacros(actor);
 }
 
-Macro* GameInterface::findMacro(Actor* actor, std::string macroName)
+void GameInterface::loadAllActors()
+{
+    std::lock_guard<std::mutex> lock(loadMutex);
+    for (Actor& a : actors) loadActor(a);
+}
+
+Actor* GameInterface::findActor(std::string_view name)
+{
+    auto iter = actorsByName.find(name);
+    return iter != actorsByName.end() ? iter->second : nullptr;
+}
+
+Macro* GameInterface::findMacro(Actor* actor, std::string_view macroName)
 {
     if (!actor) return nullptr;
-    for (Macro& m : actor->macroList)
-        if (m.name == macroName) return &m;
     
-    return nullptr;
+    std::unique_lock<std::mutex> lock(loadMutex, std::defer_lock);
+    if (lazy)
+    {
+        lock.lock();
+        loadActor(*actor);
+    }
+    
+    auto iter = macrosByName.find(MacroKey { actor, macroName });
+    return iter != macrosByName.end() ? iter->second : nullptr;
+}
+
+Actor* GameInterface::findActorAt(uint32_t offset)
+{
+    auto iter = actorsByOffset.find(offset);
+    return iter != actorsByOffset.end() ? iter->second : nullptr;
+}
+
+Macro* GameInterface::findMacroAt(uint32_t offset)
+{
+    // In lazy mode, findMacro may be adding to the index on another thread.
+    std::unique_lock<std::mutex> lock(loadMutex, std::defer_lock);
+    if (lazy) lock.lock();
+    
+    auto iter = macrosByOffset.find(offset);
+    return iter != macrosByOffset.end() ? iter->second : nullptr;
 }
 
 int GameInterface::insertTree(NodeTree& tree)
 {
     if (!targetActor) return -1;
     
-    // Find the files in which the target actor is located
-    std::fstream& levelStream = level[targetActor->fileID]->levelFile;
-    std::fstream& pointerStream = level[targetActor->fileID]->pointerFile;
-    
-    levelStream.seekg(0, levelStream.end);
-    long levelStreamSize = levelStream.tellg();
-    levelStream.seekg(0, levelStream.beg);
+    // Find the file in which the target actor is located
+    MappedFile& levelFile = level[targetActor->fileID]->levelFile;
     
-    pointerStream.seekg(0, pointerStream.end);
-    long pointerStreamSize = pointerStream.tellg();
-    pointerStream.seekg(0, pointerStream.beg);
-    
-    // Seek to the end of the level
-    levelStream.seekg(0, levelStream.end);
+    // The script is assembled in memory and appended to the end of the level in one write.
+    std::string script;
     // Script marker begin
-    levelStream << "cpascpt.begin" << '\0' << '\0' << '\0';
+    script.append("cpascpt.begin\0\0\0", 16);
     
-    long textRegionOffset = levelStream.tellg();
-    // Allocate size for the text region
-    for (int i = 0; i < tree.textRegionSize(); i++) levelStream << '\0';
+    long textRegionOffset = long(levelFile.fileSize() + script.size());
+    // Text region
+    script.append(tree.strings);
     
-    for (Node node : tree.nodes)
-    {
-        uint32_t param = 0;
-        
-        switch (node.type)
-        {
-            case NodeType::String:
-            {
-                auto save = levelStream.tellg();
-                levelStream.seekg(textRegionOffset);
-                param = textRegionOffset;
-                std::string text = std::any_cast<std::string>(node.param);
-                levelStream << text;
-                textRegionOffset += text.length() + 4 - (text.length() % 4);
-                levelStream.seekg(save);
-                break;
-            }
-                
-            case NodeType::Real:
-            {
-                float f = std::any_cast<float>(node.param);
-                param = *(uint32_t*)&f;
-                break;
-            }
-                
-            default:
-                param = std::any_cast<uint32_t>(node.param);
-                break;
-        }
-        
-        param = swap32(param);
-        
-        uint8_t padding[3] = {0, 0, 0};
-        levelStream.write((char*)&param, 4);
-        levelStream.write((char*)&padding, 3);
-        levelStream.write((char*)&node.type, 1);
-        levelStream.write((char*)&padding, 2);
-        levelStream.write((char*)&node.depth, 1);
-        levelStream.write((char*)&padding, 1);
-    }
+    // Nodes; string parameters are offsets into the string pool, which is laid out as the text region.
+    tree.encode(script, uint32_t(textRegionOffset));
     
     // Script marker end
-    levelStream << "cpascpt.end" << '\0' << '\0' << '\0' << '\0' << '\0';
+    script.append("cpascpt.end\0\0\0\0\0", 16);
+    
+    if (levelFile.append(script.data(), script.size()) < 0) return -1;
     
-    levelStream.close();
+    // Appending changed the level file, but none of what the sidecar holds.
+    if (!symbolCachePath.empty()) storeSymbolCache();
     
     return 0;
 }
@@ -9,10 +9,17 @@
 #define interface_hh
 
 #include <map>
+#include <mutex>
 #include <unordered_map>
-#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "nodetree.hh"
+#include "mappedfile.hh"
+#include "relocation.hh"
+#include "structview.hh"
+#include "pipeline.hh"
 
 #define swap16(data) \
     ((((data) >> 8) & 0x00FF) | (((data) << 8) & 0xFF00))
@@ -33,36 +40,20 @@ typedef uint32_t doublepointer;
 struct Level;
 struct GameInterface;
 
+// Names view the mapped level files, or GameInterface::nameArena.
+
 struct Macro
 {
-    std::string name;
+    std::string_view name;
     uint32_t offset;
 };
 
 struct Behavior
 {
-    std::string name;
+    std::string_view name;
     uint32_t offset;
 };
 
-struct LinkedList
-{
-    readonly pointer start;
-    readonly pointer end;
-    readonly uint32_t count;
-};
-
-struct ObjectTypeElement
-{
-    pointer next;
-    pointer prev;
-    pointer father;
-    pointer name;
-    uint8_t priority;
-    uint8_t identifier;
-    uint8_t padding[2];
-};
-
 struct Actor
 {
     uint32_t familyType;
@@ -74,53 +65,119 @@ struct Actor
     std::vector<Macro> macroList;
     
     
-    std::string name;
+    std::string_view name;
     
     uint32_t offset;
     int fileID;
+    // Whether the behaviour and macro lists have been read
+    bool aiLoaded = false;
 };
 
 struct Level
 {
     GameInterface* interface;
-    std::fstream& levelFile;
-    std::fstream& pointerFile;
-    std::unordered_map<pointer, std::pair<pointer, uint8_t /* file */> >pointers;
+    MappedFile& levelFile;
+    MappedFile& pointerFile;
+    // Sequential read cursors
+    MappedStream levelStream;
+    MappedStream pointerStream;
+    RelocationTable pointers;
     bool isFix;
     
     int numTextures = 0;
+    bool headerRead = false;
     
-    void ReadActor(std::fstream& stream, uint8_t fileID);
-    
-    Level(GameInterface* interface, std::fstream& lvl, std::fstream& ptr, bool isFix = true);
+    Level(GameInterface* interface, MappedFile& lvl, MappedFile& ptr, bool isFix = true);
+    void ReadPointers();
     void ReadFillInPointers();
+    // Reads the level header, up to the texture count. The level's header depends on the fixed level's.
+    void ReadHeader();
     void Load();
     void advance(int bytes);
     void seek(long offset);
 };
 
+// Key of a macro in the macro index: the actor it belongs to, and its name.
+struct MacroKey
+{
+    const Actor* actor;
+    std::string_view name;
+    
+    bool operator==(const MacroKey& other) const
+    {
+        return actor == other.actor && name == other.name;
+    }
+};
+
+struct MacroKeyHash
+{
+    size_t operator()(const MacroKey& key) const
+    {
+        return std::hash<std::string_view>()(key.name) ^ (std::hash<const void*>()(key.actor) * 31);
+    }
+};
+
 struct GameInterface
 {
     // [0] = fixed memory
     // [1] = level memory
     std::vector<Level*> level;
     std::vector<Actor> actors;
+    // The level files, with the pointer tables through which structures in them are read
+    Memory memory;
     // The actor in which the scripts are to be located
     Actor* targetActor = nullptr;
     
-    std::vector<std::string> familyNames;
-    std::vector<std::string> modelNames;
-    std::vector<std::string> instanceNames;
+    std::vector<std::string_view> familyNames;
+    std::vector<std::string_view> modelNames;
+    std::vector<std::string_view> instanceNames;
+    // Storage of the names read from the symbol cache, each stored once
+    std::string nameArena;
+    
+    // In lazy mode only the actors themselves are read when loading,
+    // and their behaviours and macros on the first macro lookup.
+    bool lazy = false;
+    std::mutex loadMutex;
+    // Sidecar holding the pointer tables, actors and names read from the level files, if any.
+    std::string symbolCachePath;
+    // Stages of the load, in the order in which they finished
+    std::vector<PipelineStage> loadTimings;
     
     GameInterface() {}
-    GameInterface(std::fstream& fix,
-                  std::fstream& fix_ptr,
-                  std::fstream& lvl,
-                  std::fstream& lvl_ptr);
+    GameInterface(MappedFile& fix,
+                  MappedFile& fix_ptr,
+                  MappedFile& lvl,
+                  MappedFile& lvl_ptr,
+                  bool lazy = false,
+                  const std::string& symbolCache = std::string(),
+                  PipelineProgress progress = nullptr);
+    
+    void buildIndex();
+    void indexMacros(Actor& actor);
+    // Reads the behaviours and macros of an actor, if not done yet.
+    void loadActor(Actor& actor);
+    void loadAllActors();
+    
+    // Name and offset indexes. Keys view the names stored in `actors`.
+    std::unordered_map<std::string_view, Actor*> actorsByName;
+    std::unordered_map<MacroKey, Macro*, MacroKeyHash> macrosByName;
+    std::unordered_map<uint32_t, Actor*> actorsByOffset;
+    std::unordered_map<uint32_t, Macro*> macrosByOffset;
+    
+    // Lookups may be called from several threads at once.
+    Actor* findActor(std::string_view name);
+    Macro* findMacro(Actor* actor, std::string_view macroName);
+    // Reverse lookups, by the offset of the actor or macro in the level file.
+    // In lazy mode, only macros of actors loaded so far are found.
+    Actor* findActorAt(uint32_t offset);
+    Macro* findMacroAt(uint32_t offset);
     
-    Actor* findActor(std::string name);
-    Macro* findMacro(Actor* actor, std::string macroName);
     int insertTree(NodeTree& tree);
+    
+    // Reads the sidecar, if it was written for the level files as they are on disk.
+    bool loadSymbolCache();
+    // Writes the sidecar for the level files as they are on disk. All actors must be loaded.
+    void storeSymbolCache();
 };
 
 #endif /* interface_hh */
@@ -7,76 +7,261 @@
 
 #include <iostream>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
 
 #include "compile.hh"
+#include "cache.hh"
 #include "interface.hh"
+#include "parallel.hh"
 
-GameInterface gameInterface;
+// Set once the level is loaded, before any compiler runs. Lookups
+// are safe to call from every worker.
+static GameInterface* gameInterface = nullptr;
 
 static uint32_t findActor(const char* actorName)
 {
-    Actor* a = gameInterface.findActor(actorName);
+    Actor* a = gameInterface->findActor(actorName);
     return a ? a->offset : 0;
 }
 
 static uint32_t findSubroutine(const char* actorName, const char* macroName)
 {
-    Macro* m = gameInterface.findMacro(gameInterface.findActor(actorName), macroName);
+    Macro* m = gameInterface->findMacro(gameInterface->findActor(actorName), macroName);
     return m ? m->offset : 0;
 }
 
+// Collects the sources to compile: a single file, every .cpa file in
+// a directory, or the files listed in a manifest passed as @manifest.
+static std::vector<std::filesystem::path> findSources(const std::string& argument, bool& batch)
+{
+    std::vector<std::filesystem::path> sources;
+    batch = true;
+    
+    if (!argument.empty() && argument[0] == '@')
+    {
+        std::filesystem::path manifestPath = argument.substr(1);
+        std::ifstream manifest(manifestPath);
+        std::string line;
+        while (std::getline(manifest, line))
+        {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty() || line[0] == '#') continue;
+            
+            std::filesystem::path path = line;
+            sources.push_back(path.is_relative() ? manifestPath.parent_path() / path : path);
+        }
+    }
+    else if (std::filesystem::is_directory(argument))
+    {
+        for (const auto& entry : std::filesystem::directory_iterator(argument))
+            if (entry.is_regular_file() && entry.path().extension() == ".cpa") sources.push_back(entry.path());
+        std::sort(sources.begin(), sources.end());
+    }
+    else
+    {
+        sources.push_back(argument);
+        batch = false;
+    }
+    
+    return sources;
+}
+
+static void printLoadProgress(const PipelineStage& stage, unsigned finished, unsigned total)
+{
+    fprintf(stderr, "[%u/%u] %s: %.2f ms (started at %.2f ms)\n", finished, total, stage.name, stage.seconds * 1000.0, stage.start * 1000.0);
+}
+
 int main(int argc, const char * argv[])
 {
     if (argc < 4)
     {
-        printf("usage: cpascpt [fix.lvl] [*.lvl] [sourcefile]\n");
+        printf("usage: cpascpt [fix.lvl] [*.lvl] [sourcefile | directory | @manifest] [--cache directory] [--optimize] [--streaming] [--frontend antlr|native] [--compare-frontends] [--symbol-cache] [--timings]\n");
+        return -1;
+    }
+    
+    std::unique_ptr<CompileCache> cache;
+    int options = 0;
+    CompilerContext::Frontend frontend = CPASCPT_WITH_ANTLR ? CompilerContext::Frontend_ANTLR : CompilerContext::Frontend_Native;
+    // Compile every source with both front ends, and report where their trees differ.
+    bool compareFrontends = false;
+    // Keep what is read from the level files in a sidecar next to the level.
+    bool symbolCache = false;
+    // Print each loading stage as it finishes.
+    bool timings = false;
+    for (int i = 4; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--cache") && i + 1 < argc) cache.reset(new CompileCache(argv[++i]));
+        else if (!strcmp(argv[i], "--optimize")) options |= CompilerContext::Optimize;
+        else if (!strcmp(argv[i], "--streaming")) options |= CompilerContext::Streaming;
+        else if (!strcmp(argv[i], "--frontend") && i + 1 < argc)
+        {
+            const char* name = argv[++i];
+            if (!strcmp(name, "native")) frontend = CompilerContext::Frontend_Native;
+            else if (!strcmp(name, "antlr") && CPASCPT_WITH_ANTLR) frontend = CompilerContext::Frontend_ANTLR;
+            else
+            {
+                fprintf(stderr, "unknown or unavailable front end '%s'\n", name);
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--compare-frontends")) compareFrontends = true;
+        else if (!strcmp(argv[i], "--symbol-cache")) symbolCache = true;
+        else if (!strcmp(argv[i], "--timings")) timings = true;
+    }
+    
+    if (compareFrontends && !CPASCPT_WITH_ANTLR)
+    {
+        fprintf(stderr, "--compare-frontends requires the ANTLR front end\n");
         return -1;
     }
     
     std::filesystem::path fixPath = std::filesystem::path(argv[1]).replace_extension("");
     std::filesystem::path levelPath = std::filesystem::path(argv[2]).replace_extension("");
-    std::filesystem::path sourcePath = std::filesystem::path(argv[3]).remove_filename();
-    std::filesystem::path sourceFileName = std::filesystem::path(argv[3]).filename();
     
+    bool batch = false;
+    std::vector<std::filesystem::path> sources = findSources(argv[3], batch);
+    if (sources.empty())
+    {
+        fprintf(stderr, "no source files found in %s\n", argv[3]);
+        return -1;
+    }
     
-    // TODO: maybe read these into memory before initializing the interface.
-    std::fstream fixLvl(fixPath.string() + ".lvl", std::ios_base::binary | std::ios_base::in | std::ios_base::out);
-    std::fstream fixPtr(fixPath.string() + ".ptr", std::ios_base::binary | std::ios_base::in | std::ios_base::out);
-    std::fstream lvlLvl(levelPath.string() + ".lvl", std::ios_base::binary | std::ios_base::in | std::ios_base::out);
-    std::fstream lvlPtr(levelPath.string() + ".ptr", std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+    // The compiled script is appended to the target level file afterwards, not written through the mapping.
+    MappedFile fixLvl(fixPath.string() + ".lvl");
+    MappedFile fixPtr(fixPath.string() + ".ptr");
+    MappedFile lvlLvl(levelPath.string() + ".lvl");
+    MappedFile lvlPtr(levelPath.string() + ".ptr");
     
-    if (!fixLvl.is_open() || !fixPtr.is_open())
+    if (!fixLvl.isOpen() || !fixPtr.isOpen())
     {
-        fprintf(stderr, "failed to open %s: %s\n", (fixPath.string() + (fixLvl.is_open() ? "ptr" : "lvl")).c_str(), strerror(errno));
+        fprintf(stderr, "failed to open %s: %s\n", (fixPath.string() + (fixLvl.isOpen() ? ".ptr" : ".lvl")).c_str(), strerror(errno));
         return -1;
     }
     
-    if (!lvlLvl.is_open() || !lvlPtr.is_open())
+    if (!lvlLvl.isOpen() || !lvlPtr.isOpen())
     {
-        fprintf(stderr, "failed to open %s: %s\n", (levelPath.string() + (lvlLvl.is_open() ? "ptr" : "lvl")).c_str(), strerror(errno));
+        fprintf(stderr, "failed to open %s: %s\n", (levelPath.string() + (lvlLvl.isOpen() ? ".ptr" : ".lvl")).c_str(), strerror(errno));
         return -1;
     }
     
-    // Read source file
-    std::ifstream file(argv[3]);
-    std::stringstream source;
-    source << file.rdbuf();
+    // Load the game interface. Actor AI is only read for actors whose macros are called.
+    // Writing the sidecar reads that of every actor, so it is only done when asked for.
+    GameInterface game(fixLvl, fixPtr, lvlLvl, lvlPtr, true, symbolCache ? levelPath.string() + ".lvl.symcache" : std::string(), timings ? printLoadProgress : nullptr);
+    gameInterface = &game;
     
-    // Load the game interface
-    gameInterface = GameInterface(fixLvl, fixPtr, lvlLvl, lvlPtr);
+    // Compile! Every worker thread reuses its own compiler context.
+    unsigned workers = parallelWorkerCount();
+    std::vector<std::unique_ptr<CompilerContext>> compilers(workers);
+    std::vector<NodeTree> trees(sources.size());
+    std::vector<std::vector<Diagnostic>> diagnostics(sources.size());
+    std::atomic<size_t> cached(0);
+    std::vector<std::string> mismatches(sources.size());
     
-    // Compile!
-    CompilerContext compiler(CompilerContext::Target::Target_R3_GC);
-    compiler.callbackFindActor = findActor;
-    compiler.callbackFindSubroutine = findSubroutine;
-    compiler.compile(source.str());
+    parallelFor(sources.size(), workers, [&](size_t i, unsigned worker) {
+        std::unique_ptr<CompilerContext>& compiler = compilers[worker];
+        if (!compiler)
+        {
+            compiler.reset(new CompilerContext(CompilerContext::Target::Target_R3_GC, CompilerContext::Options(options)));
+            compiler->callbackFindActor = findActor;
+            compiler->callbackFindSubroutine = findSubroutine;
+            compiler->loadTables();
+            compiler->frontend = frontend;
+        }
+        
+        // Map the source file, and compile it in place.
+        MappedFile file;
+        if (!file.open(sources[i].string()))
+        {
+            diagnostics[i].push_back(Diagnostic { Diagnostic::Error, 0, 0, std::string("cannot open source file: ") + strerror(errno) });
+            return;
+        }
+        std::string_view source((const char*)file.data, file.size);
+        
+        if (compareFrontends)
+        {
+            compiler->frontend = CompilerContext::Frontend_ANTLR;
+            compiler->nodetree.clear();
+            compiler->compile(source);
+            trees[i] = compiler->nodetree;
+            diagnostics[i] = compiler->diagnostics;
+            
+            compiler->frontend = CompilerContext::Frontend_Native;
+            compiler->nodetree.clear();
+            compiler->compile(source);
+            
+            // Trees with errors are not compared, as the two parsers recover differently.
+            bool antlrErrors = std::any_of(diagnostics[i].begin(), diagnostics[i].end(), [](const Diagnostic& d) { return d.severity == Diagnostic::Error; });
+            bool nativeErrors = compiler->errorCount() != 0;
+            if (antlrErrors != nativeErrors) mismatches[i] = antlrErrors ? "only the ANTLR front end reported errors" : "only the native front end reported errors";
+            else if (!antlrErrors) mismatches[i] = trees[i].difference(compiler->nodetree);
+            return;
+        }
+        
+        if (cache && cache->load(*compiler, source, trees[i]))
+        {
+            diagnostics[i] = compiler->diagnostics;
+            cached++;
+        }
+        else
+        {
+            compiler->nodetree.clear();
+            compiler->compile(source);
+            trees[i] = compiler->nodetree;
+            diagnostics[i] = compiler->diagnostics;
+            if (cache && !compiler->errorCount()) cache->store(*compiler, source, trees[i]);
+        }
+        
+        std::fstream binary(sources[i].string() + ".bin", std::ios_base::out | std::ios_base::binary);
+        trees[i].write(binary);
+    });
+    
+    if (compareFrontends)
+    {
+        size_t mismatched = 0;
+        for (size_t i = 0; i < sources.size(); i++)
+        {
+            if (mismatches[i].empty()) continue;
+            fprintf(stderr, "%s: %s\n", sources[i].string().c_str(), mismatches[i].c_str());
+            mismatched++;
+        }
+        
+        printf("%zu of %zu sources compiled differently\n", mismatched, sources.size());
+        return mismatched ? -1 : 0;
+    }
+    
+    unsigned errors = 0;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        for (const Diagnostic& d : diagnostics[i])
+        {
+            const char* severity = d.severity == Diagnostic::Error ? "error" : "warning";
+            fprintf(stderr, "%s:%u:%u: %s: %s\n", sources[i].string().c_str(), d.line, d.column, severity, d.message.c_str());
+            if (d.severity == Diagnostic::Error) errors++;
+        }
+    }
+    
+    if (errors)
+    {
+        fprintf(stderr, "%u error%s, no scripts were inserted\n", errors, errors == 1 ? "" : "s");
+        return -1;
+    }
     
-    compiler.nodetree.print(compiler.nodeTypeTable);
+    if (!batch) trees[0].print(compilers[0]->tables->nodeTypeTable);
+    else printf("compiled %zu source files\n", sources.size());
+    if (cache) printf("%zu of %zu sources were up to date in the cache\n", size_t(cached), sources.size());
     
-    std::fstream binary(sourcePath.string() + sourceFileName.string() + ".bin", std::ios_base::out | std::ios_base::binary);
-    compiler.nodetree.write(binary);
+    // Insert all scripts in one pass
+    NodeTree merged;
+    for (const NodeTree& tree : trees) merged.append(tree);
     
-    gameInterface.insertTree(compiler.nodetree);
+    gameInterface->insertTree(merged);
     
     return 0;
 }
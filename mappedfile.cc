@@ -0,0 +1,148 @@
+//
+//  mappedfile.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-02.
+//
+
+#include "mappedfile.hh"
+
+#include <cerrno>
+#include <fstream>
+
+#if WIN32
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#endif
+
+#if WIN32
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    this->path = path;
+
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    GetFileSizeEx(file, &fileSize);
+
+    fileHandle = file;
+    size = size_t(fileSize.QuadPart);
+    opened = true;
+
+    // Empty files cannot be mapped.
+    if (size == 0) return true;
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping)
+    {
+        close();
+        errno = EACCES;
+        return false;
+    }
+
+    mappingHandle = mapping;
+    data = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data)
+    {
+        close();
+        errno = ENOMEM;
+        return false;
+    }
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data) UnmapViewOfFile(data);
+    if (mappingHandle) CloseHandle(mappingHandle);
+    if (fileHandle) CloseHandle(fileHandle);
+
+    data = nullptr;
+    mappingHandle = nullptr;
+    fileHandle = nullptr;
+    size = 0;
+    appended = 0;
+    opened = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path)
+{
+    close();
+
+    this->path = path;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    size = size_t(st.st_size);
+    opened = true;
+
+    // Empty files cannot be mapped.
+    if (size != 0)
+    {
+        void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            int error = errno;
+            ::close(fd);
+            close();
+            errno = error;
+            return false;
+        }
+
+        data = (uint8_t*)address;
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data) munmap(data, size);
+
+    data = nullptr;
+    size = 0;
+    appended = 0;
+    opened = false;
+}
+
+#endif
+
+long MappedFile::append(const void* bytes, size_t length)
+{
+    if (!opened) return -1;
+
+    std::ofstream stream(path, std::ios_base::binary | std::ios_base::app);
+    if (!stream.is_open()) return -1;
+
+    long offset = long(fileSize());
+    stream.write((const char*)bytes, length);
+    if (!stream.good()) return -1;
+
+    appended += length;
+    return offset;
+}
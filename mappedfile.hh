@@ -0,0 +1,100 @@
+//
+//  mappedfile.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-02.
+//
+
+#ifndef mappedfile_hh
+#define mappedfile_hh
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Cursor over a region of a mapped file. Mirrors the small subset of
+// std::fstream used by the level reader, so reading is plain memory access.
+struct MappedStream
+{
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+
+    MappedStream() {}
+    MappedStream(const uint8_t* base, size_t size, size_t position = 0) : base(base), size(size), position(position) {}
+
+    // Reads `length` bytes at the cursor. Bytes past the end of the file read as zero.
+    void read(void* destination, size_t length)
+    {
+        size_t available = position < size ? size - position : 0;
+        size_t count = length < available ? length : available;
+        if (count) memcpy(destination, base + position, count);
+        if (count < length) memset((uint8_t*)destination + count, 0, length - count);
+        position += length;
+    }
+
+    void ignore(size_t bytes)
+    {
+        position += bytes;
+    }
+
+    size_t tellg() const
+    {
+        return position;
+    }
+
+    void seekg(size_t offset)
+    {
+        position = offset;
+    }
+};
+
+// Read-only memory mapped view of a file on disk.
+struct MappedFile
+{
+    uint8_t* data = nullptr;
+    size_t size = 0;
+    std::string path;
+
+    MappedFile() {}
+    MappedFile(const std::string& path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Maps the file at `path`. On failure false is returned and errno is set.
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const
+    {
+        return opened;
+    }
+
+    // Returns a cursor positioned at `offset`.
+    MappedStream at(size_t offset) const
+    {
+        return MappedStream(data, size, offset);
+    }
+
+    // Size of the file on disk, including anything appended since it was mapped.
+    size_t fileSize() const
+    {
+        return size + appended;
+    }
+
+    // Appends bytes to the end of the file on disk. The mapping itself is not resized.
+    // Returned is the file offset at which the data was written, -1 on failure.
+    long append(const void* bytes, size_t length);
+
+private:
+    bool opened = false;
+    size_t appended = 0;
+#if WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+#endif /* mappedfile_hh */
@@ -0,0 +1,101 @@
+//
+//  nodetree.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-09.
+//
+
+#include "nodetree.hh"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#   include <immintrin.h>
+#   define ENCODE_SSSE3 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#   include <arm_neon.h>
+#   define ENCODE_NEON 1
+#endif
+
+// A node in host memory is laid out as [param (LE) type depth pad pad],
+// a game record as [param (BE) 0 0 0 type 0 0 depth 0].
+#define Z 0x80
+
+// Four nodes (two 16 byte loads A and B) make up three 16 byte stores.
+alignas(16) static const uint8_t shuffleA0[16] = { 3, 2, 1, 0, Z, Z, Z,  4, Z, Z,  5, Z, 11, 10,  9,  8 };
+alignas(16) static const uint8_t shuffleA1[16] = { Z, Z, Z, 12, Z, Z, 13, Z, Z, Z,  Z, Z,  Z,  Z,  Z,  Z };
+alignas(16) static const uint8_t shuffleB1[16] = { Z, Z, Z,  Z, Z, Z,  Z, Z, 3, 2,  1, 0,  Z,  Z,  Z,  4 };
+alignas(16) static const uint8_t shuffleB2[16] = { Z, Z, 5,  Z, 11, 10, 9, 8, Z, Z, Z, 12,  Z,  Z, 13,  Z };
+
+#undef Z
+
+static void encodeScalar(const Node* nodes, size_t count, uint8_t* out)
+{
+    for (size_t i = 0; i < count; i++, out += NodeRecordSize)
+    {
+        uint32_t param = nodes[i].param;
+        memset(out, 0, NodeRecordSize);
+        out[0] = uint8_t(param >> 24);
+        out[1] = uint8_t(param >> 16);
+        out[2] = uint8_t(param >>  8);
+        out[3] = uint8_t(param >>  0);
+        out[7] = nodes[i].type;
+        out[10] = nodes[i].depth;
+    }
+}
+
+#if ENCODE_SSSE3
+__attribute__((target("ssse3")))
+static size_t encodeSSSE3(const Node* nodes, size_t count, uint8_t* out)
+{
+    const __m128i a0 = _mm_load_si128((const __m128i*)shuffleA0);
+    const __m128i a1 = _mm_load_si128((const __m128i*)shuffleA1);
+    const __m128i b1 = _mm_load_si128((const __m128i*)shuffleB1);
+    const __m128i b2 = _mm_load_si128((const __m128i*)shuffleB2);
+    
+    size_t n = 0;
+    for (; n + 4 <= count; n += 4, out += 4 * NodeRecordSize)
+    {
+        __m128i A = _mm_loadu_si128((const __m128i*)(nodes + n));
+        __m128i B = _mm_loadu_si128((const __m128i*)(nodes + n + 2));
+        _mm_storeu_si128((__m128i*)(out +  0), _mm_shuffle_epi8(A, a0));
+        _mm_storeu_si128((__m128i*)(out + 16), _mm_or_si128(_mm_shuffle_epi8(A, a1), _mm_shuffle_epi8(B, b1)));
+        _mm_storeu_si128((__m128i*)(out + 32), _mm_shuffle_epi8(B, b2));
+    }
+    
+    return n;
+}
+#endif
+
+#if ENCODE_NEON
+static size_t encodeNEON(const Node* nodes, size_t count, uint8_t* out)
+{
+    const uint8x16_t a0 = vld1q_u8(shuffleA0);
+    const uint8x16_t a1 = vld1q_u8(shuffleA1);
+    const uint8x16_t b1 = vld1q_u8(shuffleB1);
+    const uint8x16_t b2 = vld1q_u8(shuffleB2);
+    
+    size_t n = 0;
+    for (; n + 4 <= count; n += 4, out += 4 * NodeRecordSize)
+    {
+        // Out of range indices (0x80) produce zero.
+        uint8x16_t A = vld1q_u8((const uint8_t*)(nodes + n));
+        uint8x16_t B = vld1q_u8((const uint8_t*)(nodes + n + 2));
+        vst1q_u8(out +  0, vqtbl1q_u8(A, a0));
+        vst1q_u8(out + 16, vorrq_u8(vqtbl1q_u8(A, a1), vqtbl1q_u8(B, b1)));
+        vst1q_u8(out + 32, vqtbl1q_u8(B, b2));
+    }
+    
+    return n;
+}
+#endif
+
+void encodeNodes(const Node* nodes, size_t count, uint8_t* out)
+{
+    size_t n = 0;
+#if ENCODE_SSSE3
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (hasSSSE3) n = encodeSSSE3(nodes, count, out);
+#elif ENCODE_NEON
+    n = encodeNEON(nodes, count, out);
+#endif
+    encodeScalar(nodes + n, count - n, out + n * NodeRecordSize);
+}
@@ -8,9 +8,14 @@
 #ifndef nodetree_hh
 #define nodetree_hh
 
-#include <any>
+#include <algorithm>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_map>
 
 enum NodeType
 {
@@ -63,24 +68,157 @@ enum NodeType
 
 struct Node
 {
+    // String: offset of the text in NodeTree::strings.
+    // Real: IEEE-754 bits of the value.
+    uint32_t param;
     uint8_t type;
     uint8_t depth;
-    std::any param;
+    uint8_t padding[2];
+};
+
+static_assert(sizeof(Node) == 8, "Node must stay 8 bytes");
+
+// Size of a node in the game's script format.
+static const size_t NodeRecordSize = 12;
+
+// Converts nodes into big-endian game records, NodeRecordSize bytes each.
+void encodeNodes(const Node* nodes, size_t count, uint8_t* out);
+
+// Structure of a node tree, built in one pass over its nodes.
+// All fields are indexed by node, and are NodeTreeIndex::None where there is no such node.
+struct NodeTreeIndex
+{
+    static constexpr uint32_t None = UINT32_MAX;
+    
+    // One past the last node of the subtree
+    std::vector<uint32_t> end;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> nextSibling;
+    
+    void build(const std::vector<Node>& nodes)
+    {
+        size_t count = nodes.size();
+        end.assign(count, uint32_t(count));
+        parent.assign(count, None);
+        nextSibling.assign(count, None);
+        
+        // Open subtrees, innermost last. A child is attached to the nearest shallower node,
+        // so a child which is more than one level deeper than its parent is still found.
+        struct Open { uint32_t node; uint32_t lastChild; };
+        std::vector<Open> stack;
+        uint32_t lastTopLevel = None;
+        
+        for (uint32_t i = 0; i < count; i++)
+        {
+            while (!stack.empty() && nodes[stack.back().node].depth >= nodes[i].depth)
+            {
+                end[stack.back().node] = i;
+                stack.pop_back();
+            }
+            
+            uint32_t& previous = stack.empty() ? lastTopLevel : stack.back().lastChild;
+            if (previous != None) nextSibling[previous] = i;
+            previous = i;
+            
+            if (!stack.empty()) parent[i] = stack.back().node;
+            stack.push_back({ i, None });
+        }
+    }
+    
+    uint32_t firstChild(uint32_t node) const
+    {
+        return node + 1 < end[node] ? node + 1 : None;
+    }
+    
+    size_t size() const
+    {
+        return end.size();
+    }
 };
 
 struct NodeTree
 {
     std::vector<Node> nodes;
+    // String literals, each null terminated and padded to four bytes. Identical strings are stored once.
+    std::string strings;
+    std::unordered_map<std::string, uint32_t> stringOffsets;
     int depth = 1;
     
     void add(Node node)
     {
         nodes.push_back(node);
+        invalidate();
+    }
+    
+    // Adds a string to the string pool, returning its offset.
+    uint32_t intern(const std::string& text)
+    {
+        auto iter = stringOffsets.find(text);
+        if (iter != stringOffsets.end()) return iter->second;
+        
+        uint32_t offset = uint32_t(strings.size());
+        strings.append(text);
+        strings.append(4 - (text.length() % 4), '\0');
+        stringOffsets.emplace(text, offset);
+        return offset;
+    }
+    
+    // Appends the nodes of another tree, moving its strings into this tree's pool.
+    void append(const NodeTree& other)
+    {
+        nodes.reserve(nodes.size() + other.nodes.size());
+        for (Node node : other.nodes)
+        {
+            if (node.type == NodeType::String) node.param = intern(other.string(node));
+            nodes.push_back(node);
+        }
+        invalidate();
+    }
+    
+    const char* string(const Node& node) const
+    {
+        return strings.data() + node.param;
+    }
+    
+    static uint32_t realBits(float f)
+    {
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+        return bits;
+    }
+    
+    static float real(const Node& node)
+    {
+        float f;
+        memcpy(&f, &node.param, 4);
+        return f;
     }
     
     void clear()
     {
         nodes.clear();
+        strings.clear();
+        stringOffsets.clear();
+        depth = 1;
+        invalidate();
+    }
+    
+    // Returns the structure of the tree, building it if the tree has changed since.
+    // Code that modifies `nodes` directly must call invalidate() afterwards.
+    // The index is built on first use, so a tree shared between threads must be indexed before it is shared.
+    const NodeTreeIndex& index() const
+    {
+        if (!indexValid || structure.size() != nodes.size())
+        {
+            structure.build(nodes);
+            indexValid = true;
+        }
+        return structure;
+    }
+    
+    void invalidate()
+    {
+        indexValid = false;
     }
     
     unsigned length()
@@ -90,22 +228,12 @@ struct NodeTree
     
     unsigned textRegionSize()
     {
-        unsigned length = 0;
-        for (Node node : nodes)
-        {
-            if (node.type == NodeType::String)
-            {
-                length += std::any_cast<std::string>(node.param).length();
-                length = length + 4 - (length % 4);
-            }
-        }
-        
-        return length;
+        return unsigned(strings.size());
     }
     
-    void print(std::vector<std::string>& nodeTypes)
+    void print(const std::vector<std::string>& nodeTypes)
     {
-        for (Node node : nodes)
+        for (const Node& node : nodes)
         {
             for (int i = 0; i < (node.depth - 1) * 4; i++)
                 printf(" ");
@@ -113,51 +241,77 @@ struct NodeTree
             switch (node.type)
             {
                 case NodeType::String:
-                    printf("%s: \"%s\" (%d)\n", nodeTypes[node.type].c_str(), std::any_cast<std::string>(node.param).c_str(), node.depth);
+                    printf("%s: \"%s\" (%d)\n", nodeTypes[node.type].c_str(), string(node), node.depth);
                     break;
                     
                 case NodeType::Real:
-                    printf("%s: %g (%d)\n", nodeTypes[node.type].c_str(), std::any_cast<float>(node.param), node.depth);
+                    printf("%s: %g (%d)\n", nodeTypes[node.type].c_str(), real(node), node.depth);
                     break;
                     
                 default:
-                    printf("%s: %d (%d)\n", nodeTypes[node.type].c_str(), std::any_cast<uint32_t>(node.param), node.depth);
+                    printf("%s: %d (%d)\n", nodeTypes[node.type].c_str(), node.param, node.depth);
             }
         }
     }
     
-    void write(std::fstream& stream)
+    // Describes the first difference between this tree and another, empty if they are the same.
+    std::string difference(const NodeTree& other) const
     {
-        for (Node node : nodes)
+        size_t count = std::min(nodes.size(), other.nodes.size());
+        for (size_t i = 0; i < count; i++)
         {
-            uint8_t type = node.type;
-            uint8_t depth = node.depth;
-            uint32_t param = 0;
-            uint8_t padding[3] = {0, 0, 0};
+            const Node& x = nodes[i];
+            const Node& y = other.nodes[i];
+            bool same = x.type == y.type && x.depth == y.depth;
+            if (same && x.type == NodeType::String) same = !strcmp(string(x), other.string(y));
+            else if (same) same = x.param == y.param;
             
-            switch (type)
+            if (!same)
             {
-                case NodeType::String:
-                    param = 0;
-                    break;
-                    
-                case NodeType::Real:
-                    *(uint32_t*)&param = std::any_cast<float>(node.param);
-                    break;
-                    
-                default:
-                    param = std::any_cast<uint32_t>(node.param);
-                    break;
+                char description[128];
+                snprintf(description, sizeof description, "node %zu differs: type %d param %u depth %d, other type %d param %u depth %d",
+                         i, x.type, x.param, x.depth, y.type, y.param, y.depth);
+                return description;
             }
-            
-            stream.write((char*)&param, 4);
-            stream.write((char*)&padding, 3);
-            stream.write((char*)&type, 1);
-            stream.write((char*)&padding, 2);
-            stream.write((char*)&depth, 1);
-            stream.write((char*)&padding, 1);
         }
+        
+        if (nodes.size() != other.nodes.size())
+            return "node count differs: " + std::to_string(nodes.size()) + ", other " + std::to_string(other.nodes.size());
+        
+        return std::string();
     }
+    
+    // Appends the nodes to `out` as game records. String parameters are offset by `stringBase`.
+    void encode(std::string& out, uint32_t stringBase = 0) const
+    {
+        size_t start = out.size();
+        out.resize(start + nodes.size() * NodeRecordSize);
+        
+        uint8_t* records = (uint8_t*)&out[start];
+        encodeNodes(nodes.data(), nodes.size(), records);
+        
+        if (stringBase == 0 || strings.empty()) return;
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            if (nodes[i].type != NodeType::String) continue;
+            uint32_t param = nodes[i].param + stringBase;
+            records[i * NodeRecordSize + 0] = uint8_t(param >> 24);
+            records[i * NodeRecordSize + 1] = uint8_t(param >> 16);
+            records[i * NodeRecordSize + 2] = uint8_t(param >>  8);
+            records[i * NodeRecordSize + 3] = uint8_t(param >>  0);
+        }
+    }
+    
+    void write(std::fstream& stream)
+    {
+        std::string records;
+        encode(records);
+        stream.write(records.data(), records.size());
+    }
+    
+private:
+    mutable NodeTreeIndex structure;
+    mutable bool indexValid = false;
 };
 
 #endif /* nodetree_hh */
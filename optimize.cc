@@ -0,0 +1,632 @@
+//
+//  optimize.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-20.
+//
+
+#include "optimize.hh"
+
+#include <climits>
+#include <utility>
+
+// The node list is a pre-order walk of the script, where the children of a
+// node are the nodes after it that are deeper than it. The passes work on an
+// explicit tree, which is flattened back into nodes when they are done.
+struct OptNode
+{
+    Node node {};
+    ValueType type = Type_Unknown;
+    // Depth relative to the parent. Usually 1, but some constructs (unary `+`) skip a level.
+    int offset = 1;
+    std::vector<OptNode> children;
+};
+
+#pragma mark - Tree
+
+static void buildTree(OptNode& n, const NodeTree& tree, const std::vector<ValueType>* types, uint32_t i)
+{
+    const NodeTreeIndex& index = tree.index();
+    n.node = tree.nodes[i];
+    if (types && i < types->size()) n.type = (*types)[i];
+    for (uint32_t child = index.firstChild(i); child != NodeTreeIndex::None; child = index.nextSibling[child])
+    {
+        n.children.emplace_back();
+        buildTree(n.children.back(), tree, types, child);
+        n.children.back().offset = tree.nodes[child].depth - tree.nodes[i].depth;
+    }
+}
+
+static OptNode buildTree(const NodeTree& tree, const std::vector<ValueType>* types, size_t first)
+{
+    OptNode root;
+    const NodeTreeIndex& index = tree.index();
+    for (uint32_t i = uint32_t(first); i < tree.nodes.size(); i = index.end[i])
+    {
+        root.children.emplace_back();
+        buildTree(root.children.back(), tree, types, i);
+        root.children.back().offset = tree.nodes[i].depth;
+    }
+    return root;
+}
+
+static void flatten(const OptNode& n, int depth, std::vector<Node>& out)
+{
+    Node node = n.node;
+    node.depth = uint8_t(depth);
+    out.push_back(node);
+    for (const OptNode& child : n.children) flatten(child, depth + child.offset, out);
+}
+
+// Replaces `n` by its child at `index`, which takes over the position of `n`.
+static void replaceWithChild(OptNode& n, size_t index)
+{
+    OptNode child = std::move(n.children[index]);
+    child.offset = n.offset;
+    n = std::move(child);
+}
+
+static bool equal(const OptNode& a, const OptNode& b)
+{
+    if (a.node.type != b.node.type || a.node.param != b.node.param) return false;
+    if (a.offset != b.offset || a.children.size() != b.children.size()) return false;
+    for (size_t i = 0; i < a.children.size(); i++)
+        if (!equal(a.children[i], b.children[i])) return false;
+    return true;
+}
+
+static bool isOperator(const OptNode& n, uint32_t op, size_t numChildren)
+{
+    return n.node.type == NodeType::Operator && n.node.param == op && n.children.size() == numChildren;
+}
+
+static bool isCondition(const OptNode& n, uint32_t op, size_t numChildren)
+{
+    return n.node.type == NodeType::Condition && n.node.param == op && n.children.size() == numChildren;
+}
+
+// Whether evaluating `n` may change the state of the game.
+static bool hasSideEffects(const OptNode& n)
+{
+    switch (n.node.type)
+    {
+        case NodeType::Function:
+        case NodeType::Procedure:
+        case NodeType::MetaAction:
+        case NodeType::SubRoutine:
+            return true;
+        case NodeType::Condition:
+            // Conditions past the operators (collision tests etc.) are engine calls.
+            if (n.node.param >= 10) return true;
+            break;
+        case NodeType::Operator:
+            // Assignments
+            if ((n.node.param >= 6 && n.node.param <= 12) || n.node.param >= 22) return true;
+            // Field access reads another actor, which may not be valid.
+            if (n.node.param == 13) return true;
+            break;
+    }
+
+    for (const OptNode& child : n.children) if (hasSideEffects(child)) return true;
+    return false;
+}
+
+// Whether `n` can be evaluated without a guard: it is made of literals, the actor's own
+// dsgvars, comparisons, logic and arithmetic other than division only.
+static bool isUnguarded(const OptNode& n)
+{
+    switch (n.node.type)
+    {
+        case NodeType::Constant:
+        case NodeType::Real:
+        case NodeType::DsgVarRef:
+        case NodeType::DsgVarRef2:
+            break;
+        case NodeType::Condition:
+            if (n.node.param > 9) return false;
+            break;
+        case NodeType::Operator:
+            // +, -, *, unary -
+            if (n.node.param > 4 || n.node.param == 3) return false;
+            break;
+        default:
+            return false;
+    }
+
+    for (const OptNode& child : n.children) if (!isUnguarded(child)) return false;
+    return true;
+}
+
+#pragma mark - Literals
+
+struct Value
+{
+    bool real = false;
+    int32_t i = 0;
+    float f = 0.0f;
+
+    float asReal() const
+    {
+        return real ? f : float(i);
+    }
+
+    bool is(int v) const
+    {
+        return real ? f == float(v) : i == v;
+    }
+};
+
+static bool literal(const OptNode& n, Value& v)
+{
+    if (!n.children.empty()) return false;
+    if (n.node.type == NodeType::Constant)
+    {
+        v.real = false;
+        v.i = int32_t(n.node.param);
+        return true;
+    }
+    if (n.node.type == NodeType::Real)
+    {
+        v.real = true;
+        v.f = NodeTree::real(n.node);
+        return true;
+    }
+    return false;
+}
+
+static void makeLiteral(OptNode& n, const Value& v)
+{
+    n.node.type = v.real ? NodeType::Real : NodeType::Constant;
+    n.node.param = v.real ? NodeTree::realBits(v.f) : uint32_t(v.i);
+    n.children.clear();
+}
+
+// Whether `n` is known to evaluate to a real. Mixed arithmetic promotes to real.
+static bool isReal(const OptNode& n)
+{
+    if (n.node.type == NodeType::Real || n.type == Type_Real) return true;
+    if (n.node.type != NodeType::Operator) return false;
+    if (n.node.param > 4) return false;
+    for (const OptNode& child : n.children) if (isReal(child)) return true;
+    return false;
+}
+
+// Evaluates `a op b` for the arithmetic operators. Returns false if it cannot be folded.
+static bool evaluate(uint32_t op, const Value& a, const Value& b, Value& result)
+{
+    if (a.real || b.real)
+    {
+        float x = a.asReal(), y = b.asReal();
+        result.real = true;
+        switch (op)
+        {
+            case 0: result.f = x + y; return true;
+            case 1: result.f = x - y; return true;
+            case 2: result.f = x * y; return true;
+            case 3: result.f = x / y; return y != 0.0f;
+        }
+        return false;
+    }
+
+    // Integers wrap like they do in the engine.
+    uint32_t x = uint32_t(a.i), y = uint32_t(b.i);
+    result.real = false;
+    switch (op)
+    {
+        case 0: result.i = int32_t(x + y); return true;
+        case 1: result.i = int32_t(x - y); return true;
+        case 2: result.i = int32_t(x * y); return true;
+        case 3:
+        case 5:
+            if (b.i == 0 || (a.i == INT_MIN && b.i == -1)) return false;
+            result.i = op == 3 ? a.i / b.i : a.i % b.i;
+            return true;
+    }
+    return false;
+}
+
+#pragma mark - Conditions
+
+// The engine has no boolean literal, so constant conditions are written as a comparison of two constants.
+static void makeConstantCondition(OptNode& n, bool value)
+{
+    OptNode zero;
+    zero.node.type = NodeType::Constant;
+    zero.node.param = 0;
+
+    n.node.type = NodeType::Condition;
+    n.node.param = value ? 4 /* == */ : 5 /* != */;
+    n.children.assign(2, zero);
+}
+
+static bool isConstantCondition(const OptNode& n)
+{
+    if (!isCondition(n, 4, 2) && !isCondition(n, 5, 2)) return false;
+    for (const OptNode& child : n.children)
+        if (child.node.type != NodeType::Constant || child.node.param != 0 || !child.children.empty() || child.offset != 1) return false;
+    return true;
+}
+
+// Determines the value of a condition made up of literals only.
+static bool constantCondition(const OptNode& n, bool& value)
+{
+    if (n.node.type != NodeType::Condition) return false;
+
+    uint32_t op = n.node.param;
+    if (op == 2 /* ! */ && n.children.size() == 1)
+    {
+        if (!constantCondition(n.children[0], value)) return false;
+        value = !value;
+        return true;
+    }
+
+    if (n.children.size() != 2) return false;
+
+    if (op <= 3)
+    {
+        bool a, b;
+        if (!constantCondition(n.children[0], a) || !constantCondition(n.children[1], b)) return false;
+        if (op == 0) value = a && b;
+        if (op == 1) value = a || b;
+        if (op == 3) value = a != b;
+        return op != 2;
+    }
+
+    Value a, b;
+    if (op > 9 || !literal(n.children[0], a) || !literal(n.children[1], b)) return false;
+
+    if (a.real || b.real)
+    {
+        float x = a.asReal(), y = b.asReal();
+        value = op == 4 ? x == y : op == 5 ? x != y : op == 6 ? x < y : op == 7 ? x > y : op == 8 ? x <= y : x >= y;
+    }
+    else
+    {
+        int32_t x = a.i, y = b.i;
+        value = op == 4 ? x == y : op == 5 ? x != y : op == 6 ? x < y : op == 7 ? x > y : op == 8 ? x <= y : x >= y;
+    }
+
+    return true;
+}
+
+#pragma mark - Simplification
+
+static bool isIf(const OptNode& n);
+
+// Whether `n` evaluates to 0 or 1.
+static bool isBoolean(const OptNode& n)
+{
+    return n.type == Type_Boolean || (n.node.type == NodeType::Condition && n.node.param <= 9);
+}
+
+// Whether the children of `n` are used as conditions, where only their truth matters.
+static bool usesConditions(const OptNode& n)
+{
+    return isIf(n) || (n.node.type == NodeType::Condition && n.node.param <= 2 /* &&, ||, ! */);
+}
+
+// Applies one rewrite to `n`. Returns whether anything was changed.
+// `condition` tells whether `n` is used as a condition; elsewhere its value must stay 0 or 1.
+static bool simplifyNode(OptNode& n, bool condition)
+{
+    Value a, b, result;
+
+    if (n.node.type == NodeType::Condition && n.node.param <= 9)
+    {
+        bool value;
+        if (constantCondition(n, value))
+        {
+            if (isConstantCondition(n)) return false;
+            makeConstantCondition(n, value);
+            return true;
+        }
+
+        // !!c -> c
+        if (isCondition(n, 2, 1) && isCondition(n.children[0], 2, 1) && (condition || isBoolean(n.children[0].children[0])))
+        {
+            replaceWithChild(n, 0);
+            replaceWithChild(n, 0);
+            return true;
+        }
+
+        // c && true -> c, c || false -> c, and the same with the operands swapped.
+        if (isCondition(n, 0, 2) || isCondition(n, 1, 2))
+        {
+            bool isAnd = n.node.param == 0;
+            for (size_t k = 0; k < 2; k++)
+            {
+                if (!constantCondition(n.children[k], value)) continue;
+                if (value == isAnd)
+                {
+                    // Outside a condition, && and || still turn the other operand into 0 or 1.
+                    if (!condition && !isBoolean(n.children[1 - k])) continue;
+                    replaceWithChild(n, 1 - k);
+                    return true;
+                }
+                if (!hasSideEffects(n.children[1 - k]))
+                {
+                    makeConstantCondition(n, value);
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    if (n.node.type != NodeType::Operator) return false;
+    uint32_t op = n.node.param;
+
+    // Unary minus
+    if (op == 4 && n.children.size() == 1)
+    {
+        if (literal(n.children[0], a))
+        {
+            if (a.real) a.f = -a.f;
+            else a.i = int32_t(0u - uint32_t(a.i));
+            makeLiteral(n, a);
+            return true;
+        }
+
+        // --x -> x
+        if (isOperator(n.children[0], 4, 1))
+        {
+            replaceWithChild(n, 0);
+            replaceWithChild(n, 0);
+            return true;
+        }
+
+        return false;
+    }
+
+    // x = x op y -> x op= y
+    if (op == 12 && n.children.size() == 2)
+    {
+        OptNode& target = n.children[0];
+        OptNode& value = n.children[1];
+        if (value.node.type != NodeType::Operator || value.children.size() != 2 || value.node.param > 3) return false;
+        if (hasSideEffects(target)) return false;
+
+        uint32_t valueOp = value.node.param;
+        bool commutative = valueOp == 0 || valueOp == 2;
+
+        size_t operand;
+        if (equal(target, value.children[0])) operand = 1;
+        else if (commutative && equal(target, value.children[1])) operand = 0;
+        else return false;
+
+        n.node.param = 6 + valueOp; // +=, -=, *=, /=
+        replaceWithChild(value, operand);
+        return true;
+    }
+
+    if (op > 5 || op == 4 || n.children.size() != 2) return false;
+
+    bool literalA = literal(n.children[0], a);
+    bool literalB = literal(n.children[1], b);
+
+    if (literalA && literalB)
+    {
+        if (!evaluate(op, a, b, result)) return false;
+        makeLiteral(n, result);
+        return true;
+    }
+
+    // x / c -> x * (1 / c), when the division is done on reals.
+    if (op == 3 && literalB && !b.is(0) && (b.real || isReal(n.children[0])))
+    {
+        Value reciprocal;
+        reciprocal.real = true;
+        reciprocal.f = 1.0f / b.asReal();
+        n.node.param = 2;
+        makeLiteral(n.children[1], reciprocal);
+        return true;
+    }
+
+    // x * 1, 1 * x, x + 0, 0 + x, x - 0, x / 1 -> x.
+    // A real literal is only dropped if x is a real too, since it would otherwise change the type of the result.
+    for (size_t k = 0; k < 2; k++)
+    {
+        const Value& v = k == 0 ? a : b;
+        if (!(k == 0 ? literalA : literalB)) continue;
+        if (v.real && !isReal(n.children[1 - k])) continue;
+
+        bool identity = false;
+        if (op == 0) identity = v.is(0);
+        if (op == 1) identity = k == 1 && v.is(0);
+        if (op == 2) identity = v.is(1);
+        if (op == 3) identity = k == 1 && v.is(1);
+
+        if (identity)
+        {
+            replaceWithChild(n, 1 - k);
+            return true;
+        }
+    }
+
+    // (c1 * x) * c2 -> x * (c1 * c2), and the same for addition.
+    if ((op == 0 || op == 2) && (literalA || literalB))
+    {
+        const Value& outer = literalA ? a : b;
+        OptNode& inner = n.children[literalA ? 1 : 0];
+        if (!isOperator(inner, op, 2)) return false;
+
+        Value innerValue;
+        size_t k;
+        if (literal(inner.children[0], innerValue)) k = 0;
+        else if (literal(inner.children[1], innerValue)) k = 1;
+        else return false;
+
+        if (!evaluate(op, innerValue, outer, result)) return false;
+
+        OptNode x = std::move(inner.children[1 - k]);
+        OptNode c = std::move(inner.children[k]);
+        makeLiteral(c, result);
+
+        n.children.clear();
+        n.children.push_back(std::move(x));
+        n.children.push_back(std::move(c));
+        return true;
+    }
+
+    return false;
+}
+
+static void simplify(OptNode& n, bool condition = false)
+{
+    for (OptNode& child : n.children) simplify(child, usesConditions(n));
+    // Every rewrite makes the tree smaller or moves literals outwards, so this terminates.
+    for (int i = 0; i < 16 && simplifyNode(n, condition); i++)
+        for (OptNode& child : n.children) simplify(child, usesConditions(n));
+}
+
+#pragma mark - Statements
+
+// Keywords
+#define KEYWORD_IF          0
+#define KEYWORD_IFNOT       1
+#define KEYWORD_IF2         2  // If2 to If64 evaluate their condition every 2^n frames.
+#define KEYWORD_IFNOT2      8
+#define KEYWORD_IFNOT64     13
+#define KEYWORD_THEN        16
+#define KEYWORD_ELSE        17
+
+static bool isKeyword(const OptNode& n, uint32_t keyword)
+{
+    return n.node.type == NodeType::KeyWord && n.node.param == keyword;
+}
+
+static bool isIf(const OptNode& n)
+{
+    return n.node.type == NodeType::KeyWord && n.node.param <= KEYWORD_IFNOT64;
+}
+
+// Swaps an If keyword for its IfNot counterpart and back.
+static uint32_t negatedIf(uint32_t keyword)
+{
+    if (keyword == KEYWORD_IF) return KEYWORD_IFNOT;
+    if (keyword == KEYWORD_IFNOT) return KEYWORD_IF;
+    return keyword < KEYWORD_IFNOT2 ? keyword + 6 : keyword - 6;
+}
+
+// Rewrites one if-statement, appending what is left of it to `out`. `elseNode` may be null.
+static void rewriteIf(OptNode& ifNode, OptNode& thenNode, OptNode* elseNode, std::vector<OptNode>& out)
+{
+    if (ifNode.children.size() != 1)
+    {
+        out.push_back(std::move(ifNode));
+        out.push_back(std::move(thenNode));
+        if (elseNode) out.push_back(std::move(*elseNode));
+        return;
+    }
+
+    OptNode& condition = ifNode.children[0];
+
+    // If !c -> IfNot c
+    while (isCondition(condition, 2, 1))
+    {
+        ifNode.node.param = negatedIf(ifNode.node.param);
+        replaceWithChild(condition, 0);
+    }
+
+    if (elseNode && elseNode->children.empty()) elseNode = nullptr;
+
+    // Only plain ifs are evaluated every frame, so only their constant branches can be resolved.
+    bool value;
+    if (ifNode.node.param <= KEYWORD_IFNOT && constantCondition(condition, value))
+    {
+        if (ifNode.node.param == KEYWORD_IFNOT) value = !value;
+        OptNode* taken = value ? &thenNode : elseNode;
+        if (taken)
+        {
+            for (OptNode& statement : taken->children)
+            {
+                statement.offset = ifNode.offset;
+                out.push_back(std::move(statement));
+            }
+        }
+        return;
+    }
+
+    if (thenNode.children.empty())
+    {
+        if (!elseNode)
+        {
+            if (!hasSideEffects(condition)) return;
+        }
+        else
+        {
+            // if (c) {} else {...} -> IfNot c {...}
+            ifNode.node.param = negatedIf(ifNode.node.param);
+            thenNode.children.swap(elseNode->children);
+            elseNode = nullptr;
+        }
+    }
+
+    // if (a) { if (b) {...} } -> if (a && b) {...}
+    // The engine's && is not known to short-circuit, so b must be safe to evaluate when a is false.
+    if (!elseNode && ifNode.node.param == KEYWORD_IF && thenNode.children.size() == 2)
+    {
+        OptNode& innerIf = thenNode.children[0];
+        OptNode& innerThen = thenNode.children[1];
+        if (isKeyword(innerIf, KEYWORD_IF) && isKeyword(innerThen, KEYWORD_THEN) && innerIf.children.size() == 1 && isUnguarded(innerIf.children[0]))
+        {
+            OptNode conjunction;
+            conjunction.node.type = NodeType::Condition;
+            conjunction.node.param = 0 /* && */;
+            conjunction.offset = condition.offset;
+            condition.offset = 1;
+            conjunction.children.push_back(std::move(condition));
+            conjunction.children.push_back(std::move(innerIf.children[0]));
+            conjunction.children.back().offset = 1;
+
+            ifNode.children[0] = std::move(conjunction);
+            std::vector<OptNode> body = std::move(innerThen.children);
+            thenNode.children = std::move(body);
+        }
+    }
+
+    out.push_back(std::move(ifNode));
+    out.push_back(std::move(thenNode));
+    if (elseNode) out.push_back(std::move(*elseNode));
+}
+
+// Peephole pass over a list of statements and the blocks within it.
+static void peephole(std::vector<OptNode>& statements)
+{
+    for (OptNode& statement : statements)
+        if (isKeyword(statement, KEYWORD_THEN) || isKeyword(statement, KEYWORD_ELSE)) peephole(statement.children);
+
+    std::vector<OptNode> out;
+    out.reserve(statements.size());
+    for (size_t i = 0; i < statements.size(); i++)
+    {
+        if (!isIf(statements[i]) || i + 1 >= statements.size() || !isKeyword(statements[i + 1], KEYWORD_THEN))
+        {
+            out.push_back(std::move(statements[i]));
+            continue;
+        }
+
+        OptNode& ifNode = statements[i];
+        OptNode& thenNode = statements[i + 1];
+        OptNode* elseNode = (i + 2 < statements.size() && isKeyword(statements[i + 2], KEYWORD_ELSE)) ? &statements[i + 2] : nullptr;
+        i += elseNode ? 2 : 1;
+
+        rewriteIf(ifNode, thenNode, elseNode, out);
+    }
+
+    statements.swap(out);
+}
+
+void optimizeNodeTree(NodeTree& tree, size_t first, const std::vector<ValueType>* types)
+{
+    if (first >= tree.nodes.size()) return;
+
+    OptNode root = buildTree(tree, types, first);
+    for (OptNode& statement : root.children) simplify(statement);
+    peephole(root.children);
+
+    tree.nodes.resize(first);
+    for (const OptNode& statement : root.children) flatten(statement, statement.offset, tree.nodes);
+    tree.invalidate();
+}
@@ -0,0 +1,21 @@
+//
+//  optimize.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-20.
+//
+
+#ifndef optimize_hh
+#define optimize_hh
+
+#include "nodetree.hh"
+#include "typecheck.hh"
+
+// Simplifies the nodes of `tree` starting at `first`, which must be the first node of a statement.
+// Folds literal arithmetic and comparisons, removes arithmetic identities and
+// rewrites `x = x op y` into `x op= y`. Then turns `if (!c)` into IfNot, drops
+// empty else blocks and branches that can never run, and merges nested ifs.
+// String offsets are left unchanged. `types`, if given, holds the type of every node from the type check.
+void optimizeNodeTree(NodeTree& tree, size_t first = 0, const std::vector<ValueType>* types = nullptr);
+
+#endif /* optimize_hh */
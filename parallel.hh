@@ -0,0 +1,45 @@
+//
+//  parallel.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-12.
+//
+
+#ifndef parallel_hh
+#define parallel_hh
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use by default.
+static inline unsigned parallelWorkerCount()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// Calls fn(index, worker) for every index in [0, count), spread over `workers` threads.
+// `worker` is in [0, workers) and identifies the calling thread, for per-thread state.
+template <typename Function>
+static void parallelFor(size_t count, unsigned workers, Function&& fn)
+{
+    if (workers > count) workers = unsigned(count);
+    if (workers <= 1)
+    {
+        for (size_t i = 0; i < count; i++) fn(i, 0u);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto work = [&](unsigned worker) {
+        for (size_t i = next++; i < count; i = next++) fn(i, worker);
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned w = 1; w < workers; w++) threads.emplace_back(work, w);
+    work(0);
+    for (std::thread& t : threads) t.join();
+}
+
+#endif /* parallel_hh */
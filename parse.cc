@@ -0,0 +1,834 @@
+//
+//  parse.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-24.
+//
+
+#include "parse.hh"
+#include "symbols.hh"
+
+#include <charconv>
+#include <cstring>
+
+#if defined(__SSE2__)
+#   include <emmintrin.h>
+#   define CPASCPT_SSE2 1
+#else
+#   define CPASCPT_SSE2 0
+#endif
+
+// Binding strength of the operators, as given by the order of the singleExpression alternatives.
+// Operators of equal strength associate to the left, assignments included.
+#define PRECEDENCE_ASSIGN   1
+#define PRECEDENCE_TERNARY  2
+#define PRECEDENCE_LOGICAL  3
+#define PRECEDENCE_COMPARE  4
+#define PRECEDENCE_ARITH    5
+#define PRECEDENCE_PREFIX   6
+#define PRECEDENCE_DOT      7
+
+struct BinaryOperator
+{
+    const char* text;
+    int precedence;
+    NodeType type;
+    uint32_t code;
+};
+
+static const BinaryOperator binaryOperators[] =
+{
+    { "=",  PRECEDENCE_ASSIGN,  NodeType::Operator,  12 },
+    { "+=", PRECEDENCE_ASSIGN,  NodeType::Operator,  6 },
+    { "-=", PRECEDENCE_ASSIGN,  NodeType::Operator,  7 },
+    { "*=", PRECEDENCE_ASSIGN,  NodeType::Operator,  8 },
+    { "/=", PRECEDENCE_ASSIGN,  NodeType::Operator,  9 },
+    { "&&", PRECEDENCE_LOGICAL, NodeType::Condition, 0 },
+    { "||", PRECEDENCE_LOGICAL, NodeType::Condition, 1 },
+    { "==", PRECEDENCE_COMPARE, NodeType::Condition, 4 },
+    { "!=", PRECEDENCE_COMPARE, NodeType::Condition, 5 },
+    { "<",  PRECEDENCE_COMPARE, NodeType::Condition, 6 },
+    { ">",  PRECEDENCE_COMPARE, NodeType::Condition, 7 },
+    { "<=", PRECEDENCE_COMPARE, NodeType::Condition, 8 },
+    { ">=", PRECEDENCE_COMPARE, NodeType::Condition, 9 },
+    { "+",  PRECEDENCE_ARITH,   NodeType::Operator,  0 },
+    { "-",  PRECEDENCE_ARITH,   NodeType::Operator,  1 },
+    { "*",  PRECEDENCE_ARITH,   NodeType::Operator,  2 },
+    { "/",  PRECEDENCE_ARITH,   NodeType::Operator,  3 },
+    { "%",  PRECEDENCE_ARITH,   NodeType::Operator,  5 },
+};
+
+static const BinaryOperator* findBinaryOperator(std::string_view text)
+{
+    for (const BinaryOperator& op : binaryOperators)
+        if (text == op.text) return &op;
+    return nullptr;
+}
+
+static const char* punctuation2[] = { "++", "--", "<=", ">=", "==", "!=", "&&", "||", "+=", "-=", "*=", "/=" };
+static const char punctuation1[] = "{}(),;.?:+-!*/%<>=";
+
+static bool isWordCharacter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool isHexDigit(char c)
+{
+    return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+#pragma mark - Scanning
+
+// Runs of whitespace and the contents of comments are scanned sixteen bytes at a time.
+// Loads never go past the end of the source, so it need not be null terminated.
+
+static bool isWhitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Returns the offset of the first character at or after `i` which is not whitespace.
+static size_t skipWhitespace(const char* s, size_t i, size_t n)
+{
+#if CPASCPT_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i blank = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, space), _mm_cmpeq_epi8(chunk, tab)),
+                                     _mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf)));
+        unsigned mask = ~unsigned(_mm_movemask_epi8(blank)) & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+    while (i < n && isWhitespace(s[i])) i++;
+    return i;
+}
+
+// Returns the offset of the first line break at or after `i`, or `n`.
+static size_t findLineEnd(const char* s, size_t i, size_t n)
+{
+#if CPASCPT_SSE2
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(s + i));
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, cr), _mm_cmpeq_epi8(chunk, lf))));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+    while (i < n && s[i] != '\n' && s[i] != '\r') i++;
+    return i;
+}
+
+// Returns the number of '\n' in [i, end), moving `lineStart` past the last of them.
+static unsigned countLines(const char* s, size_t i, size_t end, size_t& lineStart)
+{
+    unsigned lines = 0;
+#if CPASCPT_SSE2
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; i + 16 <= end; i += 16)
+    {
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(s + i)), lf)));
+        if (mask)
+        {
+            lines += __builtin_popcount(mask);
+            lineStart = i + (31 - __builtin_clz(mask)) + 1;
+        }
+    }
+#endif
+    for (; i < end; i++)
+    {
+        if (s[i] == '\n')
+        {
+            lines++;
+            lineStart = i + 1;
+        }
+    }
+    return lines;
+}
+
+// Returns the offset of the "*/" closing a comment whose contents start at `i`, or `n`.
+static size_t findCommentEnd(const char* s, size_t i, size_t n)
+{
+    while (i + 1 < n)
+    {
+        const void* star = memchr(s + i, '*', n - i - 1);
+        if (!star) break;
+        i = size_t((const char*)star - s);
+        if (s[i + 1] == '/') return i;
+        i++;
+    }
+    return n;
+}
+
+// Numbers are converted as std::stoi and std::stof would: an integer stops at the first
+// character which is not a digit, so 0x1F is 0. Both fail if the value is out of range.
+static bool parseInteger(std::string_view text, unsigned& value)
+{
+    int result = 0;
+    std::from_chars_result r = std::from_chars(text.data(), text.data() + text.size(), result);
+    if (r.ec != std::errc()) return false;
+    value = unsigned(result);
+    return true;
+}
+
+static bool parseReal(std::string_view text, float& value)
+{
+    std::from_chars_result r = std::from_chars(text.data(), text.data() + text.size(), value);
+    return r.ec == std::errc();
+}
+
+#pragma mark - Lexer
+
+void NativeParser::lex()
+{
+    tokens.clear();
+
+    const char* s = source.data();
+    size_t n = source.size();
+    size_t i = 0;
+    unsigned line = 1;
+    size_t lineStart = 0;
+
+    auto push = [&](TokenType type, size_t start) {
+        tokens.push_back(Token { type, line, unsigned(start - lineStart), uint32_t(start), uint32_t(i - start) });
+    };
+
+    auto warn = [&](size_t at, const std::string& message) {
+        compiler->report(Diagnostic::Warning, line, unsigned(at - lineStart), message);
+    };
+
+    while (i < n)
+    {
+        char c = s[i];
+        size_t start = i;
+
+        if (isWhitespace(c))
+        {
+            i = skipWhitespace(s, i, n);
+            line += countLines(s, start, i, lineStart);
+            continue;
+        }
+
+        // Comments
+        if (c == '/' && i + 1 < n && s[i + 1] == '/')
+        {
+            i = findLineEnd(s, i + 2, n);
+            continue;
+        }
+
+        if (c == '/' && i + 1 < n && s[i + 1] == '*')
+        {
+            size_t end = findCommentEnd(s, i + 2, n);
+            if (end == n) warn(start, "Unterminated comment");
+            i = end == n ? n : end + 2;
+            line += countLines(s, start, i, lineStart);
+            continue;
+        }
+
+        // Names and keywords
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+        {
+            while (i < n && isWordCharacter(s[i])) i++;
+            std::string_view word(s + start, i - start);
+
+            TokenType type = Token_Name;
+            if      (word == "if") type = Token_If;
+            else if (word == "else") type = Token_Else;
+            else if (word == "every") type = Token_Every;
+            else if (word == "self" || word == "this") type = Token_Self;
+            else if (word == "null" || word == "NULL") type = Token_Null;
+            else if (word == "true" || word == "false") type = Token_Boolean;
+            else if (word == "dsgVar") type = Token_DsgVar;
+            else if (word == "dsg" || word == "dv") type = Token_DsgVarAlias;
+            else if (word == "new") type = Token_New;
+            else if (word == "Vector" || word == "Vector3" || word == "Vector3f") type = Token_VectorName;
+            else if (word.length() == 1 && strchr("xyzXYZ", c)) type = Token_Component;
+            else for (std::string_view field : R3Fields) if (word == field) type = Token_Field;
+
+            // A name is at least two characters long.
+            if (type == Token_Name && word.length() < 2)
+            {
+                warn(start, "token recognition error at: '" + std::string(word) + "'");
+                continue;
+            }
+
+            push(type, start);
+            continue;
+        }
+
+        // Numbers
+        if (isDigit(c) || (c == '.' && i + 1 < n && isDigit(s[i + 1])))
+        {
+            if (c == '0' && i + 2 < n && (s[i + 1] == 'x' || s[i + 1] == 'X') && isHexDigit(s[i + 2]))
+            {
+                i += 2;
+                while (i < n && isHexDigit(s[i])) i++;
+                push(Token_Hexadecimal, start);
+                continue;
+            }
+
+            // A leading zero is a number of its own.
+            if (c == '0') i++;
+            else while (i < n && isDigit(s[i])) i++;
+
+            if (i < n && s[i] == '.')
+            {
+                i++;
+                while (i < n && isDigit(s[i])) i++;
+            }
+
+            if (i < n && (s[i] == 'e' || s[i] == 'E'))
+            {
+                size_t exponent = i + 1;
+                if (exponent < n && (s[exponent] == '+' || s[exponent] == '-')) exponent++;
+                if (exponent < n && isDigit(s[exponent]))
+                {
+                    i = exponent;
+                    while (i < n && isDigit(s[i])) i++;
+                }
+            }
+
+            push(Token_Decimal, start);
+            continue;
+        }
+
+        // Strings
+        if (c == '"' || c == '\'')
+        {
+            unsigned startLine = line;
+            unsigned startColumn = unsigned(start - lineStart);
+            i++;
+            while (i < n && s[i] != c && s[i] != '\n' && s[i] != '\r')
+            {
+                // An escaped line break continues the string on the next line.
+                if (s[i] == '\\' && i + 1 < n && s[i + 1] == '\n')
+                {
+                    line++;
+                    lineStart = i + 2;
+                }
+                i += (s[i] == '\\' && i + 1 < n) ? 2 : 1;
+            }
+
+            if (i >= n || s[i] != c)
+            {
+                compiler->report(Diagnostic::Warning, startLine, startColumn, "Unterminated string literal");
+                continue;
+            }
+
+            i++;
+            tokens.push_back(Token { Token_String, startLine, startColumn, uint32_t(start), uint32_t(i - start) });
+            continue;
+        }
+
+        // Punctuation
+        bool found = false;
+        for (const char* p : punctuation2)
+        {
+            if (i + 1 < n && s[i] == p[0] && s[i + 1] == p[1])
+            {
+                i += 2;
+                found = true;
+                break;
+            }
+        }
+
+        if (!found && c != '\0' && strchr(punctuation1, c))
+        {
+            i++;
+            found = true;
+        }
+
+        if (!found)
+        {
+            i++;
+            warn(start, "token recognition error at: '" + std::string(1, c) + "'");
+            continue;
+        }
+
+        push(Token_Punctuation, start);
+    }
+
+    tokens.push_back(Token { Token_End, line, unsigned(i - lineStart), uint32_t(i), 0 });
+}
+
+
+#pragma mark - Parser
+
+bool NativeParser::accept(const char* punctuation)
+{
+    const Token& token = peek();
+    if (token.type != Token_Punctuation || text(token) != punctuation) return false;
+    position++;
+    return true;
+}
+
+void NativeParser::expect(const char* punctuation)
+{
+    if (!accept(punctuation)) fail(std::string("Expected '") + punctuation + "'");
+}
+
+void NativeParser::fail(const std::string& message)
+{
+    const Token& token = peek();
+    if (token.type == Token_End) report(uint32_t(position), message + " at end of file");
+    else report(uint32_t(position), message + " before '" + std::string(text(token)) + "'");
+    throw SyntaxError();
+}
+
+void NativeParser::report(uint32_t token, const std::string& message)
+{
+    compiler->report(Diagnostic::Error, tokens[token].line, tokens[token].column, message);
+}
+
+int32_t NativeParser::makeSyntax(SyntaxKind kind, uint32_t token, uint8_t nodeType, uint32_t code)
+{
+    SyntaxNode node;
+    node.kind = kind;
+    node.token = token;
+    node.nodeType = nodeType;
+    node.code = code;
+    nodes.push_back(node);
+    return int32_t(nodes.size() - 1);
+}
+
+void NativeParser::append(int32_t parent, int32_t child)
+{
+    if (nodes[parent].lastChild >= 0) nodes[nodes[parent].lastChild].nextSibling = child;
+    else nodes[parent].firstChild = child;
+    nodes[parent].lastChild = child;
+}
+
+void NativeParser::parse(std::string_view source)
+{
+    this->source = source;
+    lex();
+    nodes.clear();
+    position = 0;
+
+    // Each statement is emitted as soon as it has been parsed, and its syntax tree dropped.
+    while (peek().type != Token_End)
+    {
+        size_t start = position;
+        try
+        {
+            int32_t statement = parseStatement();
+            emit(statement);
+        }
+        catch (const SyntaxError&)
+        {
+            // Skip to the end of the statement.
+            if (position == start) position++;
+            while (peek().type != Token_End)
+            {
+                const Token& token = tokens[position++];
+                if (token.type == Token_Punctuation && (text(token) == ";" || text(token) == "}")) break;
+            }
+        }
+        nodes.clear();
+    }
+}
+
+int32_t NativeParser::parseStatement()
+{
+    uint32_t start = uint32_t(position);
+
+    if (accept("{"))
+    {
+        int32_t block = makeSyntax(Syntax_Sequence, start);
+        while (!accept("}"))
+        {
+            if (peek().type == Token_End) fail("Expected '}'");
+            int32_t statement = parseStatement();
+            append(block, statement);
+        }
+        return block;
+    }
+
+    if (peek().type == Token_If || peek().type == Token_Every) return parseIfStatement();
+
+    int32_t expressions = parseExpressionSequence();
+    if (!accept(";") && peek().type != Token_End) fail("Expected ';'");
+    return expressions;
+}
+
+int32_t NativeParser::parseIfStatement()
+{
+    uint32_t start = uint32_t(position);
+    uint32_t keyword = 0 /* If */;
+
+    if (peek().type == Token_Every)
+    {
+        position++;
+        expect("(");
+        if (peek().type != Token_Decimal && peek().type != Token_Hexadecimal) fail("Expected frame interval");
+
+        // every(1) is a plain If, every(2) to every(64) are If2 to If64.
+        std::string interval(text(tokens[position++]));
+        if      (interval ==  "1") keyword = 0;
+        else if (interval ==  "2") keyword = 2;
+        else if (interval ==  "4") keyword = 3;
+        else if (interval ==  "8") keyword = 4;
+        else if (interval == "16") keyword = 5;
+        else if (interval == "32") keyword = 6;
+        else if (interval == "64") keyword = 7;
+        else report(start, "Invalid frame interval '" + interval + "': must be one of 1, 2, 4, 8, 16, 32 or 64");
+
+        expect(")");
+    }
+
+    if (peek().type != Token_If) fail("Expected 'if'");
+    position++;
+
+    int32_t statement = makeSyntax(Syntax_If, start, 0, keyword);
+
+    expect("(");
+    int32_t condition = parseExpressionSequence();
+    expect(")");
+    append(statement, condition);
+
+    int32_t body = parseStatement();
+    append(statement, body);
+
+    if (peek().type == Token_Else)
+    {
+        position++;
+        int32_t elseBody = parseStatement();
+        append(statement, elseBody);
+    }
+
+    return statement;
+}
+
+int32_t NativeParser::parseExpressionSequence()
+{
+    int32_t sequence = makeSyntax(Syntax_Sequence, uint32_t(position));
+    do
+    {
+        int32_t expression = parseExpression(0);
+        append(sequence, expression);
+    }
+    while (accept(","));
+    return sequence;
+}
+
+int32_t NativeParser::parseExpression(int precedence)
+{
+    uint32_t start = uint32_t(position);
+    int32_t left = parsePrefix();
+
+    for (;;)
+    {
+        const Token& token = peek();
+        if (token.type != Token_Punctuation) break;
+
+        if (text(token) == "." && PRECEDENCE_DOT >= precedence)
+        {
+            position++;
+            int32_t access;
+            if (peek().type == Token_Component)
+            {
+                char c = text(peek())[0];
+                uint32_t component = (c == 'x' || c == 'X') ? 14 : (c == 'y' || c == 'Y') ? 15 : 16;
+                position++;
+                access = makeSyntax(Syntax_Component, start, NodeType::Operator, component);
+                append(access, left);
+            }
+            else
+            {
+                int32_t right = parseExpression(PRECEDENCE_DOT + 1);
+                access = makeSyntax(Syntax_Operator, start, NodeType::Operator, 13 /* . */);
+                append(access, left);
+                append(access, right);
+            }
+            left = access;
+            continue;
+        }
+
+        if (text(token) == "?" && PRECEDENCE_TERNARY >= precedence)
+        {
+            position++;
+            int32_t a = parseExpression(0);
+            expect(":");
+            int32_t b = parseExpression(PRECEDENCE_TERNARY + 1);
+
+            // The ternary operator has no node; its operands are emitted one after the other.
+            int32_t ternary = makeSyntax(Syntax_Sequence, start);
+            append(ternary, left);
+            append(ternary, a);
+            append(ternary, b);
+            left = ternary;
+            continue;
+        }
+
+        const BinaryOperator* op = findBinaryOperator(text(token));
+        if (!op || op->precedence < precedence) break;
+        position++;
+
+        int32_t right = parseExpression(op->precedence + 1);
+        int32_t binary = makeSyntax(Syntax_Operator, start, op->type, op->code);
+        append(binary, left);
+        append(binary, right);
+        left = binary;
+    }
+
+    return left;
+}
+
+int32_t NativeParser::parsePrefix()
+{
+    uint32_t start = uint32_t(position);
+    const Token& token = peek();
+    if (token.type != Token_Punctuation) return parsePrimary();
+
+    int32_t prefix;
+    std::string_view op = text(token);
+    if      (op == "++" || op == "--") prefix = makeSyntax(Syntax_Sequence, start);
+    else if (op == "+") prefix = makeSyntax(Syntax_UnaryPlus, start);
+    else if (op == "-") prefix = makeSyntax(Syntax_Operator, start, NodeType::Operator, 4);
+    else if (op == "!") prefix = makeSyntax(Syntax_Operator, start, NodeType::Condition, 2 /* ! */);
+    else return parsePrimary();
+
+    position++;
+    int32_t operand = parseExpression(PRECEDENCE_PREFIX);
+    append(prefix, operand);
+    return prefix;
+}
+
+int32_t NativeParser::parsePrimary()
+{
+    uint32_t start = uint32_t(position);
+    const Token& token = peek();
+
+    switch (token.type)
+    {
+        case Token_Self:
+        case Token_Null:
+        case Token_Field:
+            // These emit nothing.
+            position++;
+            return makeSyntax(Syntax_Sequence, start);
+
+        case Token_Decimal:
+        case Token_Hexadecimal:
+            position++;
+            return makeSyntax(Syntax_Number, start);
+
+        case Token_String:
+            position++;
+            return makeSyntax(Syntax_String, start);
+
+        case Token_Boolean:
+            position++;
+            return makeSyntax(Syntax_Boolean, start, 0, text(token) == "true");
+
+        case Token_DsgVar:
+        {
+            position++;
+            expect("(");
+            if (peek().type != Token_Decimal && peek().type != Token_Hexadecimal) fail("Expected dsgvar identifier");
+            int32_t dsgVar = makeSyntax(Syntax_DsgVar, start, 0, uint32_t(position++));
+            expect(")");
+            return dsgVar;
+        }
+
+        case Token_New:
+        case Token_VectorName:
+        {
+            if (token.type == Token_New)
+            {
+                position++;
+                if (peek().type != Token_VectorName) fail("Expected vector type");
+            }
+            position++;
+            expect("(");
+            int32_t vector = makeSyntax(Syntax_Vector, start);
+            int32_t components = parseExpressionSequence();
+            append(vector, components);
+            expect(")");
+            return vector;
+        }
+
+        case Token_Name:
+        {
+            position++;
+            if (!accept("(")) return makeSyntax(Syntax_Actor, start);
+
+            int32_t call = makeSyntax(Syntax_Call, start);
+            if (!accept(")"))
+            {
+                do
+                {
+                    int32_t argument = parseExpression(0);
+                    append(call, argument);
+                }
+                while (accept(","));
+                expect(")");
+            }
+            return call;
+        }
+
+        case Token_Punctuation:
+            if (accept("("))
+            {
+                int32_t expressions = parseExpressionSequence();
+                expect(")");
+                return expressions;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    fail("Expected expression");
+}
+
+#pragma mark - Emitter
+
+void NativeParser::emit(int32_t index)
+{
+    const SyntaxNode& node = nodes[index];
+    const Token& token = tokens[node.token];
+    compiler->location = SourceLocation { token.line, token.column };
+
+    auto emitChildren = [&]() {
+        for (int32_t child = node.firstChild; child >= 0; child = nodes[child].nextSibling) emit(child);
+    };
+
+    switch (node.kind)
+    {
+        case Syntax_Sequence:
+            emitChildren();
+            break;
+
+        case Syntax_If:
+        {
+            int32_t condition = node.firstChild;
+            int32_t body = nodes[condition].nextSibling;
+            int32_t elseBody = nodes[body].nextSibling;
+
+            compiler->makeNode(NodeType::KeyWord, node.code);
+            compiler->shiftDepth(+1);
+            emit(condition);
+            compiler->shiftDepth(-1);
+            compiler->makeNode(NodeType::KeyWord, 16u /* Then */);
+            compiler->shiftDepth(+1);
+            emit(body);
+            if (elseBody >= 0)
+            {
+                compiler->shiftDepth(-1);
+                compiler->makeNode(NodeType::KeyWord, 17u /* Else */);
+                compiler->shiftDepth(+1);
+                emit(elseBody);
+            }
+            compiler->shiftDepth(-1);
+            break;
+        }
+
+        case Syntax_Operator:
+            compiler->makeNode(NodeType(node.nodeType), node.code);
+            compiler->shiftDepth(+1);
+            emitChildren();
+            compiler->shiftDepth(-1);
+            break;
+
+        case Syntax_UnaryPlus:
+            compiler->shiftDepth(+1);
+            emitChildren();
+            compiler->shiftDepth(-1);
+            break;
+
+        case Syntax_Component:
+            // The component is a child of the access, before its operand.
+            compiler->makeNode(NodeType::Operator, 13u /* . */);
+            compiler->shiftDepth(+1);
+            compiler->makeNode(NodeType::Operator, node.code);
+            emitChildren();
+            compiler->shiftDepth(-1);
+            break;
+
+        case Syntax_Call:
+        {
+            std::string name(text(token));
+            const Symbol* symbol = compiler->findSymbol(name);
+            uint8_t table = symbol ? symbol->table : 0xFF;
+
+            uint32_t subroutine = 0;
+            if      (table == SymbolTable_Function)   compiler->makeNode(NodeType::Function, compiler->symbolIndex(symbol));
+            else if (table == SymbolTable_Procedure)  compiler->makeNode(NodeType::Procedure, compiler->symbolIndex(symbol));
+            else if (table == SymbolTable_Condition)  compiler->makeNode(NodeType::Condition, compiler->symbolIndex(symbol));
+            else if (table == SymbolTable_MetaAction) compiler->makeNode(NodeType::MetaAction, compiler->symbolIndex(symbol));
+            else if ((subroutine = compiler->findSubroutine(targetActorName, name)) != 0) compiler->makeNode(NodeType::SubRoutine, subroutine);
+            else report(node.token, "No such callable method '" + name + "' found");
+
+            compiler->shiftDepth(+1);
+            emitChildren();
+            compiler->shiftDepth(-1);
+            break;
+        }
+
+        case Syntax_Vector:
+            // Presume the vector is always non-constant.
+            compiler->makeNode(NodeType::Vector, 0u);
+            compiler->shiftDepth(+1);
+            emitChildren();
+            compiler->shiftDepth(-1);
+            break;
+
+        case Syntax_DsgVar:
+        {
+            std::string_view id = text(tokens[node.code]);
+            unsigned value;
+            if (parseInteger(id, value)) compiler->makeNode(NodeType::DsgVarRef2, value);
+            else report(node.token, "Invalid dsgvar identifier '" + std::string(id) + "'");
+            break;
+        }
+
+        case Syntax_Actor:
+        {
+            std::string name(text(token));
+            uint32_t address = compiler->findActor(name);
+            if (address == 0) report(node.token, "No such actor '" + name + "'");
+            compiler->makeNode(NodeType::ActorRef, address);
+            break;
+        }
+
+        case Syntax_Number:
+        {
+            std::string_view number = text(token);
+            unsigned integer;
+            float real;
+            if (number.find('.') != std::string_view::npos)
+            {
+                if (parseReal(number, real)) compiler->makeNode(NodeType::Real, real);
+                else report(node.token, "Numeric literal '" + std::string(number) + "' is out of range");
+            }
+            else
+            {
+                if (parseInteger(number, integer)) compiler->makeNode(NodeType::Constant, integer);
+                else report(node.token, "Numeric literal '" + std::string(number) + "' is out of range");
+            }
+            break;
+        }
+
+        case Syntax_String:
+            compiler->makeNode(NodeType::String, std::string(text(token).substr(1, token.length - 2)));
+            break;
+
+        case Syntax_Boolean:
+            compiler->makeBoolean(node.code != 0);
+            break;
+    }
+}
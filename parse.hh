@@ -0,0 +1,131 @@
+//
+//  parse.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-24.
+//
+
+#ifndef parse_hh
+#define parse_hh
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "compile.hh"
+
+// Hand-written front end for the language of Generic.g4. It emits the same nodes as the
+// ANTLR front end, through the same calls to the compiler context, without the ANTLR runtime.
+// Each top-level statement is parsed into a syntax tree, emitted, and dropped before the next one.
+class NativeParser
+{
+public:
+    NativeParser(CompilerContext* compiler) : compiler(compiler) { }
+
+    // Parses a source and emits its nodes. Syntax errors are reported to the compiler,
+    // and the statement containing them is skipped. The source is only borrowed for the call.
+    void parse(std::string_view source);
+
+private:
+    enum TokenType : uint8_t
+    {
+        Token_End,
+        Token_Name,
+        Token_Decimal,
+        Token_Hexadecimal,
+        Token_String,
+        Token_Field,
+        Token_If,
+        Token_Else,
+        Token_Every,
+        Token_Self,
+        Token_Null,
+        Token_Boolean,
+        Token_DsgVar,
+        Token_DsgVarAlias,
+        Token_New,
+        Token_VectorName,
+        Token_Component,
+        Token_Punctuation,
+    };
+
+    // Tokens refer to their text in the source rather than holding a copy of it.
+    struct Token
+    {
+        TokenType type;
+        // Line (starting at 1) and column (starting at 0)
+        unsigned line;
+        unsigned column;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    enum SyntaxKind : uint8_t
+    {
+        // Children in order, without a node of its own: blocks, expression lists, parentheses, `?:`, `++`, `--`.
+        Syntax_Sequence,
+        // Keyword `code`; the condition sequence, the statement and the optional else statement.
+        Syntax_If,
+        // Node of `nodeType` with parameter `code` over the operands.
+        Syntax_Operator,
+        // Unary `+`: a level of depth, but no node.
+        Syntax_UnaryPlus,
+        // a.x: `code` is the component operator.
+        Syntax_Component,
+        Syntax_Call,
+        Syntax_Vector,
+        Syntax_DsgVar,
+        Syntax_Actor,
+        Syntax_Number,
+        Syntax_String,
+        // `code` is the value.
+        Syntax_Boolean,
+    };
+
+    struct SyntaxNode
+    {
+        SyntaxKind kind;
+        uint8_t nodeType = 0;
+        uint32_t code = 0;
+        // First token of the construct
+        uint32_t token = 0;
+        int32_t firstChild = -1;
+        int32_t lastChild = -1;
+        int32_t nextSibling = -1;
+    };
+
+    // Thrown on a syntax error, and caught at the statement being parsed.
+    struct SyntaxError { };
+
+    CompilerContext* compiler;
+    std::string_view source;
+    // Actor whose subroutines are callable, as in the ANTLR front end
+    std::string targetActorName = "Rayman";
+    // Kept between sources, so that their storage is reused.
+    std::vector<Token> tokens;
+    std::vector<SyntaxNode> nodes;
+    size_t position = 0;
+
+    void lex();
+
+    const Token& peek() const { return tokens[position]; }
+    std::string_view text(const Token& token) const { return source.substr(token.offset, token.length); }
+    bool accept(const char* punctuation);
+    void expect(const char* punctuation);
+    [[noreturn]] void fail(const std::string& message);
+
+    int32_t makeSyntax(SyntaxKind kind, uint32_t token, uint8_t nodeType = 0, uint32_t code = 0);
+    void append(int32_t parent, int32_t child);
+
+    int32_t parseStatement();
+    int32_t parseIfStatement();
+    int32_t parseExpressionSequence();
+    int32_t parseExpression(int precedence);
+    int32_t parsePrefix();
+    int32_t parsePrimary();
+
+    void emit(int32_t node);
+    void report(uint32_t token, const std::string& message);
+};
+
+#endif /* parse_hh */
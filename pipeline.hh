@@ -0,0 +1,91 @@
+//
+//  pipeline.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-30.
+//
+
+#ifndef pipeline_hh
+#define pipeline_hh
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Timing of a finished pipeline stage, in seconds since the pipeline started.
+struct PipelineStage
+{
+    const char* name;
+    double start;
+    double seconds;
+};
+
+// Called as each stage finishes, with the number of stages finished so far.
+typedef void (*PipelineProgress)(const PipelineStage& stage, unsigned finished, unsigned total);
+
+// A set of stages, each run on its own thread once all of the stages it depends on have finished.
+struct Pipeline
+{
+    PipelineProgress progress = nullptr;
+    // Filled by run(), in the order in which the stages finished.
+    std::vector<PipelineStage> timings;
+
+    // Adds a stage. Dependencies are indices returned by earlier calls.
+    size_t add(const char* name, std::vector<size_t> dependencies, std::function<void()> run)
+    {
+        stages.push_back(Stage { name, std::move(dependencies), std::move(run), false });
+        return stages.size() - 1;
+    }
+
+    void run()
+    {
+        auto origin = std::chrono::steady_clock::now();
+        auto since = [origin](std::chrono::steady_clock::time_point t) {
+            return std::chrono::duration<double>(t - origin).count();
+        };
+
+        std::mutex mutex;
+        std::condition_variable finished;
+        timings.clear();
+
+        auto work = [&](Stage& stage) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&]() {
+                    for (size_t d : stage.dependencies) if (!stages[d].done) return false;
+                    return true;
+                });
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            stage.run();
+            auto end = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            stage.done = true;
+            timings.push_back(PipelineStage { stage.name, since(start), std::chrono::duration<double>(end - start).count() });
+            if (progress) progress(timings.back(), unsigned(timings.size()), unsigned(stages.size()));
+            finished.notify_all();
+        };
+
+        std::vector<std::thread> threads;
+        for (Stage& stage : stages) threads.emplace_back(work, std::ref(stage));
+        for (std::thread& t : threads) t.join();
+    }
+
+private:
+    struct Stage
+    {
+        const char* name;
+        std::vector<size_t> dependencies;
+        std::function<void()> run;
+        bool done;
+    };
+
+    std::vector<Stage> stages;
+};
+
+#endif /* pipeline_hh */
@@ -0,0 +1,106 @@
+//
+//  relocation.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-04.
+//
+
+#ifndef relocation_hh
+#define relocation_hh
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Maps the location of a pointer in a level file to the address it points to, and
+// the file that address lies in. Entries are staged with add() and become searchable
+// once build() has sorted them.
+struct RelocationTable
+{
+    // Sorted pointer locations; the target and target file of keys[i] are at targets[i] and files[i].
+    std::vector<uint32_t> keys;
+    std::vector<uint32_t> targets;
+    std::vector<uint8_t> files;
+
+    void reserve(size_t count)
+    {
+        keys.reserve(keys.size() + count);
+        targets.reserve(targets.size() + count);
+        files.reserve(files.size() + count);
+    }
+
+    void add(uint32_t key, uint32_t target, uint8_t file)
+    {
+        keys.push_back(key);
+        targets.push_back(target);
+        files.push_back(file);
+        sorted = false;
+    }
+
+    // Sorts the staged entries. Of entries with the same key, the one added last is kept.
+    void build()
+    {
+        if (sorted) return;
+
+        // Sort by key, then by insertion order.
+        std::vector<uint64_t> order(keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+            order[i] = uint64_t(keys[i]) << 32 | uint64_t(i);
+        std::sort(order.begin(), order.end());
+
+        std::vector<uint32_t> sortedKeys, sortedTargets;
+        std::vector<uint8_t> sortedFiles;
+        sortedKeys.reserve(order.size());
+        sortedTargets.reserve(order.size());
+        sortedFiles.reserve(order.size());
+
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            // Skip all but the last entry of a run of equal keys.
+            if (i + 1 < order.size() && (order[i + 1] >> 32) == (order[i] >> 32)) continue;
+
+            uint32_t index = uint32_t(order[i]);
+            sortedKeys.push_back(keys[index]);
+            sortedTargets.push_back(targets[index]);
+            sortedFiles.push_back(files[index]);
+        }
+
+        keys.swap(sortedKeys);
+        targets.swap(sortedTargets);
+        files.swap(sortedFiles);
+        sorted = true;
+    }
+
+    // Looks up the pointer stored at `key`. Returns false if there is none.
+    bool find(uint32_t key, uint32_t& target, uint8_t& file) const
+    {
+        size_t length = keys.size();
+        if (length == 0) return false;
+
+        // Branchless binary search for the last key <= `key`.
+        const uint32_t* base = keys.data();
+        while (length > 1)
+        {
+            size_t half = length / 2;
+            base += (base[half] <= key) ? half : 0;
+            length -= half;
+        }
+
+        if (*base != key) return false;
+
+        size_t index = base - keys.data();
+        target = targets[index];
+        file = files[index];
+        return true;
+    }
+
+    size_t size() const
+    {
+        return keys.size();
+    }
+
+private:
+    bool sorted = true;
+};
+
+#endif /* relocation_hh */
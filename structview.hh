@@ -0,0 +1,287 @@
+//
+//  structview.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-31.
+//
+
+#ifndef structview_hh
+#define structview_hh
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "relocation.hh"
+
+#ifndef CPASCPT_SSE2
+#   if defined(__SSE2__)
+#       include <emmintrin.h>
+#       define CPASCPT_SSE2 1
+#   else
+#       define CPASCPT_SSE2 0
+#   endif
+#endif
+
+// Game structures are read in place through typed views. A layout describes the fields of a
+// structure as types holding their offset, so that every access is resolved at compile time:
+// reading a field is a bounds check and a byte-swapping load, and following a pointer field
+// is a lookup in the relocation table of the file the field lies in.
+
+#pragma mark - Memory
+
+// One file of game memory: its bytes, and the pointers stored in them.
+struct MemoryFile
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    const RelocationTable* pointers = nullptr;
+};
+
+// [0] = fixed memory
+// [1] = level memory
+// Pointers into other files (kf, vb) are not followed.
+struct Memory
+{
+    MemoryFile files[2];
+};
+
+// Returns the offset of the first byte at or after `i` which is not printable ASCII, or `n`.
+static inline size_t findWordEnd(const uint8_t* s, size_t i, size_t n)
+{
+#if CPASCPT_SSE2
+    const __m128i below = _mm_set1_epi8(32);
+    const __m128i above = _mm_set1_epi8(127);
+    for (; i + 16 <= n; i += 16)
+    {
+        // Signed compares: bytes of 128 and up are negative, so they fail the first.
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(chunk, below), _mm_cmplt_epi8(chunk, above));
+        unsigned mask = ~unsigned(_mm_movemask_epi8(printable)) & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+#endif
+    while (i < n && s[i] >= 33 && s[i] <= 126) i++;
+    return i;
+}
+
+// Loads a big-endian value, whatever the byte order of the host.
+template <typename T>
+static inline T loadGame(const uint8_t* p)
+{
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4, "unsupported field size");
+    if (sizeof(T) == 1) return T(p[0]);
+    if (sizeof(T) == 2) return T(uint16_t(p[0] << 8 | p[1]));
+    return T(uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]));
+}
+
+#pragma mark - Layouts
+
+// Field of type T at `Offset` bytes into its structure.
+template <typename T, uint32_t Offset>
+struct ValueField
+{
+    typedef T type;
+    static constexpr uint32_t offset = Offset;
+};
+
+// Pointer field to a structure of layout `Target`. Its value is the address as stored.
+template <typename Target, uint32_t Offset>
+struct PointerField
+{
+    typedef uint32_t type;
+    typedef Target target;
+    static constexpr uint32_t offset = Offset;
+};
+
+// Inline array of `Length` bytes of text.
+template <uint32_t Length, uint32_t Offset>
+struct TextField
+{
+    static constexpr uint32_t length = Length;
+    static constexpr uint32_t offset = Offset;
+};
+
+#pragma mark - Views
+
+// Structure of layout `Layout` at an offset into one of the files. A view which points
+// nowhere is false; reading through it yields zero, and following it yields another such view.
+template <typename Layout>
+struct View
+{
+    const Memory* memory = nullptr;
+    uint8_t file = 0;
+    uint32_t offset = 0;
+
+    View() {}
+    View(const Memory* memory, uint8_t file, uint32_t offset) : memory(memory), file(file), offset(offset) {}
+
+    explicit operator bool() const
+    {
+        return memory != nullptr;
+    }
+
+    template <typename F>
+    typename F::type get() const
+    {
+        return load<typename F::type>(offset + F::offset);
+    }
+
+    // Follows a pointer field, through the table of the file the field is in.
+    template <typename F>
+    View<typename F::target> follow() const
+    {
+        uint32_t target = 0;
+        uint8_t targetFile = 0;
+        if (!memory || !memory->files[file].pointers->find(offset + F::offset, target, targetFile)) return View<typename F::target>();
+        if (target == 0 || targetFile >= 2) return View<typename F::target>();
+        return View<typename F::target>(memory, targetFile, target);
+    }
+
+    // Text up to the first null character, or the length of the field.
+    template <typename F>
+    std::string_view text() const
+    {
+        return text(offset + F::offset, F::length);
+    }
+
+    // Characters from the start of the structure up to the first which is not printable.
+    std::string_view word() const
+    {
+        if (!memory) return std::string_view();
+        const MemoryFile& f = memory->files[file];
+        if (offset >= f.size) return std::string_view();
+        size_t end = findWordEnd(f.data, offset, f.size);
+        return end > offset ? std::string_view((const char*)f.data + offset, end - offset) : std::string_view();
+    }
+
+    // The structure `index` elements after this one, in an array of them.
+    View<Layout> operator[](uint32_t index) const
+    {
+        return View<Layout>(memory, file, offset + index * Layout::size);
+    }
+
+private:
+    // Bytes past the end of the file read as zero.
+    template <typename T>
+    T load(uint32_t at) const
+    {
+        if (!memory) return T();
+        const MemoryFile& f = memory->files[file];
+        if (size_t(at) + sizeof(T) <= f.size) return loadGame<T>(f.data + at);
+
+        uint8_t bytes[sizeof(T)] = {};
+        for (size_t i = 0; i < sizeof(T) && size_t(at) + i < f.size; i++) bytes[i] = f.data[at + i];
+        return loadGame<T>(bytes);
+    }
+
+    std::string_view text(uint32_t at, uint32_t length) const
+    {
+        if (!memory) return std::string_view();
+        const MemoryFile& f = memory->files[file];
+        if (at >= f.size) return std::string_view();
+
+        size_t available = f.size - at < length ? f.size - at : length;
+        const char* s = (const char*)f.data + at;
+        const void* end = memchr(s, '\0', available);
+        return std::string_view(s, end ? (const char*)end - s : available);
+    }
+};
+
+#pragma mark - R3 structures
+
+namespace R3
+{
+    struct StdGame
+    {
+        typedef ValueField<uint32_t, 0> familyType;
+        typedef ValueField<uint32_t, 4> modelType;
+        typedef ValueField<uint32_t, 8> instanceType;
+    };
+
+    // Entry of a behaviour list: a comport, of which only the name is read.
+    struct Behavior
+    {
+        static constexpr uint32_t size = 0x10C;
+        typedef TextField<0x100, 0> name;
+    };
+
+    struct Macro
+    {
+        static constexpr uint32_t size = 0x108;
+        typedef TextField<0x100, 0> name;
+    };
+
+    struct BehaviorList
+    {
+        typedef PointerField<Behavior, 0> entries;
+        typedef ValueField<uint32_t, 4> count;
+    };
+
+    struct MacroList
+    {
+        typedef PointerField<Macro, 0> entries;
+        typedef ValueField<uint8_t, 4> count;
+    };
+
+    struct AIModel
+    {
+        typedef PointerField<BehaviorList, 0> intelligence;
+        typedef PointerField<BehaviorList, 4> reflex;
+        typedef ValueField<uint32_t, 8> dsgVars;
+        typedef PointerField<MacroList, 12> macros;
+    };
+
+    struct Mind
+    {
+        typedef PointerField<AIModel, 0> aiModel;
+    };
+
+    struct Brain
+    {
+        typedef PointerField<Mind, 0> mind;
+    };
+
+    struct Actor
+    {
+        typedef ValueField<uint32_t, 0> data3D;
+        typedef PointerField<StdGame, 4> stdGame;
+        typedef ValueField<uint32_t, 8> dynamics;
+        typedef PointerField<Brain, 12> brain;
+    };
+
+    // Slot of the fixed level's array of actors.
+    struct ActorSlot
+    {
+        static constexpr uint32_t size = 4;
+        typedef PointerField<Actor, 0> actor;
+    };
+
+    // Name of a family, model or instance, read as a word.
+    struct ObjectTypeName
+    {
+    };
+
+    struct ObjectTypeElement
+    {
+        static constexpr uint32_t size = 20;
+        typedef PointerField<ObjectTypeElement, 0> next;
+        typedef PointerField<ObjectTypeElement, 4> prev;
+        typedef PointerField<ObjectTypeElement, 8> father;
+        typedef PointerField<ObjectTypeName, 12> name;
+        typedef ValueField<uint8_t, 16> priority;
+        typedef ValueField<uint8_t, 17> identifier;
+    };
+
+    template <typename Element>
+    struct LinkedList
+    {
+        static constexpr uint32_t size = 12;
+        typedef PointerField<Element, 0> start;
+        typedef PointerField<Element, 4> end;
+        typedef ValueField<uint32_t, 8> count;
+    };
+}
+
+#endif /* structview_hh */
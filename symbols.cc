@@ -0,0 +1,12 @@
+//
+//  symbols.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-06.
+//
+
+#include "symbols.hh"
+
+static constexpr R3SymbolList R3Symbols;
+
+const R3SymbolIndexType R3SymbolIndex { R3Symbols.symbols };
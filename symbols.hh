@@ -0,0 +1,189 @@
+//
+//  symbols.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-06.
+//
+
+#ifndef symbols_hh
+#define symbols_hh
+
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+#include "types-r3.hh"
+
+enum SymbolTable : uint8_t
+{
+    SymbolTable_Function,
+    SymbolTable_Procedure,
+    SymbolTable_Condition,
+    SymbolTable_MetaAction,
+    SymbolTable_Field,
+    SymbolTable_Keyword,
+};
+
+enum SymbolFlags : uint8_t
+{
+    // Only present in the Gamecube version of the tables.
+    SymbolFlag_GamecubeOnly = 1 << 0,
+};
+
+struct Symbol
+{
+    std::string_view name;
+    uint8_t table = 0;
+    uint8_t flags = 0;
+    uint16_t index = 0;
+};
+
+constexpr uint64_t symbolHash(std::string_view name)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (char c : name)
+    {
+        hash ^= uint8_t(c);
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Minimal perfect hash over a fixed set of symbols, built with hash-and-displace:
+// every key is hashed into a bucket, and each bucket stores a displacement which
+// sends all of its keys to distinct free slots. A lookup is one hash of the name,
+// one displacement read and one string comparison. Building takes too many steps
+// for constant evaluation, so indexes are built once, during static initialization.
+template <size_t NumKeys, size_t NumSlots, size_t NumBuckets>
+struct SymbolIndex
+{
+    static_assert((NumSlots & (NumSlots - 1)) == 0, "slot count must be a power of two");
+    static_assert(NumSlots >= NumKeys, "not enough slots");
+
+    Symbol slots[NumSlots] = {};
+    uint16_t displacement[NumBuckets] = {};
+
+    static constexpr uint32_t slotOf(uint64_t hash, uint32_t d)
+    {
+        uint32_t h1 = uint32_t(hash >> 32);
+        uint32_t h2 = uint32_t(hash) | 1;
+        return (h1 + d * h2) & (NumSlots - 1);
+    }
+
+    SymbolIndex(const Symbol (&keys)[NumKeys])
+    {
+        uint64_t hashes[NumKeys] = {};
+        size_t bucketSize[NumBuckets] = {};
+        size_t bucketStart[NumBuckets + 1] = {};
+        size_t members[NumKeys] = {};
+        bool used[NumSlots] = {};
+
+        for (size_t i = 0; i < NumKeys; i++)
+        {
+            hashes[i] = symbolHash(keys[i].name);
+            bucketSize[hashes[i] % NumBuckets]++;
+        }
+
+        // Group key indices by bucket, preserving table order within a bucket.
+        for (size_t b = 0; b < NumBuckets; b++) bucketStart[b + 1] = bucketStart[b] + bucketSize[b];
+        size_t fill[NumBuckets] = {};
+        for (size_t i = 0; i < NumKeys; i++)
+        {
+            size_t b = hashes[i] % NumBuckets;
+            members[bucketStart[b] + fill[b]++] = i;
+        }
+
+        // Place the largest buckets first, while there are still many free slots.
+        size_t maxBucketSize = 0;
+        for (size_t b = 0; b < NumBuckets; b++) if (bucketSize[b] > maxBucketSize) maxBucketSize = bucketSize[b];
+
+        for (size_t size = maxBucketSize; size > 0; size--)
+        {
+            for (size_t b = 0; b < NumBuckets; b++)
+            {
+                if (bucketSize[b] != size) continue;
+
+                const size_t* bucket = members + bucketStart[b];
+                for (uint32_t d = 0; ; d++)
+                {
+                    bool fits = true;
+                    for (size_t k = 0; k < size && fits; k++)
+                    {
+                        // A name listed in several tables resolves to the first one; skip the others.
+                        if (isShadowed(keys, bucket, k)) continue;
+
+                        uint32_t slot = slotOf(hashes[bucket[k]], d);
+                        if (used[slot]) fits = false;
+                        for (size_t j = 0; j < k && fits; j++)
+                            if (!isShadowed(keys, bucket, j) && slotOf(hashes[bucket[j]], d) == slot) fits = false;
+                    }
+
+                    if (!fits) continue;
+
+                    for (size_t k = 0; k < size; k++)
+                    {
+                        if (isShadowed(keys, bucket, k)) continue;
+                        uint32_t slot = slotOf(hashes[bucket[k]], d);
+                        slots[slot] = keys[bucket[k]];
+                        used[slot] = true;
+                    }
+
+                    displacement[b] = uint16_t(d);
+                    break;
+                }
+            }
+        }
+    }
+
+    // Finds the symbol with the specified name, or nullptr if there is none.
+    constexpr const Symbol* find(std::string_view name) const
+    {
+        uint64_t hash = symbolHash(name);
+        const Symbol& symbol = slots[slotOf(hash, displacement[hash % NumBuckets])];
+        return symbol.name == name && !symbol.name.empty() ? &symbol : nullptr;
+    }
+
+private:
+    static constexpr bool isShadowed(const Symbol (&keys)[NumKeys], const size_t* bucket, size_t k)
+    {
+        for (size_t j = 0; j < k; j++)
+            if (keys[bucket[j]].name == keys[bucket[k]].name) return true;
+        return false;
+    }
+};
+
+#pragma mark - R3
+
+// Index of the Gamecube exclusive procedure, which shifts all following procedures up by one.
+static constexpr unsigned R3GamecubeProcedureIndex = 219;
+static constexpr std::string_view R3GamecubeProcedure = "FixePositionPersoGamecubeExclusive";
+
+static constexpr size_t R3NumSymbols =
+    std::size(R3Functions) + std::size(R3Procedures) + std::size(R3Conditions) +
+    std::size(R3MetaActions) + std::size(R3Fields) + std::size(R3Keywords) + 1;
+
+struct R3SymbolList
+{
+    Symbol symbols[R3NumSymbols] = {};
+
+    constexpr R3SymbolList()
+    {
+        size_t n = 0;
+        // Tables are listed in lookup priority order.
+        for (size_t i = 0; i < std::size(R3Functions); i++) symbols[n++] = { R3Functions[i], SymbolTable_Function, 0, uint16_t(i) };
+        for (size_t i = 0; i < std::size(R3Procedures); i++) symbols[n++] = { R3Procedures[i], SymbolTable_Procedure, 0, uint16_t(i) };
+        symbols[n++] = { R3GamecubeProcedure, SymbolTable_Procedure, SymbolFlag_GamecubeOnly, uint16_t(R3GamecubeProcedureIndex) };
+        for (size_t i = 0; i < std::size(R3Conditions); i++) symbols[n++] = { R3Conditions[i], SymbolTable_Condition, 0, uint16_t(i) };
+        for (size_t i = 0; i < std::size(R3MetaActions); i++) symbols[n++] = { R3MetaActions[i], SymbolTable_MetaAction, 0, uint16_t(i) };
+        for (size_t i = 0; i < std::size(R3Fields); i++) symbols[n++] = { R3Fields[i], SymbolTable_Field, 0, uint16_t(i) };
+        for (size_t i = 0; i < std::size(R3Keywords); i++) symbols[n++] = { R3Keywords[i], SymbolTable_Keyword, 0, uint16_t(i) };
+    }
+};
+
+typedef SymbolIndex<R3NumSymbols, 4096, 512> R3SymbolIndexType;
+
+// Defined in symbols.cc. Not to be used during static initialization.
+extern const R3SymbolIndexType R3SymbolIndex;
+
+#endif /* symbols_hh */
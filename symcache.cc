@@ -0,0 +1,331 @@
+//
+//  symcache.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-28.
+//
+
+#include "interface.hh"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+// Bump when the layout, or what the level reader produces, changes.
+#define SYMCACHE_VERSION 2
+#define SYMCACHE_MAGIC 0x43505359 // CPSY
+
+// Bytes hashed at the start and at the end of each level file. Size and mtime cover the rest.
+#define SYMCACHE_SAMPLE 0x10000
+
+// Identity of a level file on disk.
+struct FileKey
+{
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+
+    bool operator==(const FileKey& other) const
+    {
+        return size == other.size && mtime == other.mtime && hash == other.hash;
+    }
+};
+
+static uint64_t hashBytes(const void* data, size_t length, uint64_t hash = 0xCBF29CE484222325ull)
+{
+    // FNV-1a
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+// Reads the key of a file as it is on disk, which includes anything appended since it was mapped.
+static bool fileKey(const std::string& path, FileKey& key)
+{
+    std::error_code error;
+    key.size = std::filesystem::file_size(path, error);
+    if (error) return false;
+    key.mtime = int64_t(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+    if (error) return false;
+
+    std::ifstream file(path, std::ios_base::binary);
+    if (!file.is_open()) return false;
+
+    std::string buffer(SYMCACHE_SAMPLE, '\0');
+    size_t head = std::min<uint64_t>(SYMCACHE_SAMPLE, key.size);
+    if (!file.read(&buffer[0], head)) return false;
+    key.hash = hashBytes(buffer.data(), head);
+
+    if (key.size > SYMCACHE_SAMPLE)
+    {
+        size_t tail = std::min<uint64_t>(SYMCACHE_SAMPLE, key.size - SYMCACHE_SAMPLE);
+        file.seekg(std::streamoff(key.size - tail));
+        if (!file.read(&buffer[0], tail)) return false;
+        key.hash = hashBytes(buffer.data(), tail, key.hash);
+    }
+
+    return true;
+}
+
+// Keys of the fixed and level files, each level and pointer file in turn.
+static bool fileKeys(const std::vector<Level*>& levels, std::vector<FileKey>& keys)
+{
+    keys.clear();
+    for (const Level* level : levels)
+    {
+        FileKey lvl, ptr;
+        if (!fileKey(level->levelFile.path, lvl) || !fileKey(level->pointerFile.path, ptr)) return false;
+        keys.push_back(lvl);
+        keys.push_back(ptr);
+    }
+    return true;
+}
+
+#pragma mark - Writing
+
+template <typename T>
+static void put(std::string& out, T value)
+{
+    out.append((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+static void putArray(std::string& out, const std::vector<T>& values)
+{
+    put<uint32_t>(out, uint32_t(values.size()));
+    out.append((const char*)values.data(), values.size() * sizeof(T));
+}
+
+static void putString(std::string& out, std::string_view str)
+{
+    put<uint32_t>(out, uint32_t(str.length()));
+    out.append(str);
+}
+
+template <typename T>
+static void putList(std::string& out, const std::vector<T>& list)
+{
+    put<uint32_t>(out, uint32_t(list.size()));
+    for (const T& element : list)
+    {
+        putString(out, element.name);
+        put<uint32_t>(out, element.offset);
+    }
+}
+
+static void putNames(std::string& out, const std::vector<std::string_view>& names)
+{
+    put<uint32_t>(out, uint32_t(names.size()));
+    for (std::string_view name : names) putString(out, name);
+}
+
+void GameInterface::storeSymbolCache()
+{
+    std::vector<FileKey> keys;
+    if (!fileKeys(level, keys)) return;
+
+    std::string data;
+    put<uint32_t>(data, SYMCACHE_MAGIC);
+    put<uint32_t>(data, SYMCACHE_VERSION);
+    putArray(data, keys);
+
+    // Pointer tables are stored sorted, as they are searched.
+    for (const Level* lvl : level)
+    {
+        put<int32_t>(data, lvl->numTextures);
+        putArray(data, lvl->pointers.keys);
+        putArray(data, lvl->pointers.targets);
+        putArray(data, lvl->pointers.files);
+    }
+
+    putNames(data, familyNames);
+    putNames(data, modelNames);
+    putNames(data, instanceNames);
+
+    put<uint32_t>(data, uint32_t(actors.size()));
+    for (const Actor& actor : actors)
+    {
+        put<uint32_t>(data, actor.familyType);
+        put<uint32_t>(data, actor.modelType);
+        put<uint32_t>(data, actor.instanceType);
+        put<uint32_t>(data, actor.offset);
+        put<int32_t>(data, actor.fileID);
+        putList(data, actor.intelligenceList);
+        putList(data, actor.reflexList);
+        putList(data, actor.macroList);
+    }
+
+    // Write to a temporary file first, so that a concurrent reader never sees a partial sidecar.
+    std::stringstream temporary;
+    temporary << symbolCachePath << "." << std::this_thread::get_id() << ".tmp";
+
+    {
+        std::ofstream file(temporary.str(), std::ios_base::binary | std::ios_base::trunc);
+        if (!file.is_open()) return;
+        file.write(data.data(), data.size());
+        if (!file.good()) return;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary.str(), symbolCachePath, error);
+    if (error) std::filesystem::remove(temporary.str(), error);
+}
+
+#pragma mark - Reading
+
+// Reads past the end of the sidecar leave the stream's position past its size.
+template <typename T>
+static T get(MappedStream& in)
+{
+    T value {};
+    in.read(&value, sizeof(T));
+    return value;
+}
+
+template <typename T>
+static bool getArray(MappedStream& in, std::vector<T>& values)
+{
+    uint32_t count = get<uint32_t>(in);
+    if (in.position > in.size || count > (in.size - in.position) / sizeof(T)) return false;
+    values.resize(count);
+    in.read(values.data(), count * sizeof(T));
+    return true;
+}
+
+// Strings view the sidecar, and are interned once the whole sidecar has been read.
+static bool getString(MappedStream& in, std::string_view& str)
+{
+    uint32_t length = get<uint32_t>(in);
+    if (in.position > in.size || length > in.size - in.position) return false;
+    str = std::string_view((const char*)in.base + in.position, length);
+    in.position += length;
+    return true;
+}
+
+template <typename T>
+static bool getList(MappedStream& in, std::vector<T>& list)
+{
+    uint32_t count = get<uint32_t>(in);
+    if (in.position > in.size || count > in.size - in.position) return false;
+    list.resize(count);
+    for (T& element : list)
+    {
+        if (!getString(in, element.name)) return false;
+        element.offset = get<uint32_t>(in);
+    }
+    return in.position <= in.size;
+}
+
+static bool getNames(MappedStream& in, std::vector<std::string_view>& names)
+{
+    uint32_t count = get<uint32_t>(in);
+    if (in.position > in.size || count > in.size - in.position) return false;
+    names.resize(count);
+    for (std::string_view& name : names) if (!getString(in, name)) return false;
+    return true;
+}
+
+// Copies names into one arena, each distinct name once, and points them at their copy.
+struct NameInterner
+{
+    std::string arena;
+    std::unordered_map<std::string_view, std::string_view> interned;
+
+    // The arena must not grow past its reserved capacity, which would move the names in it.
+    // Reserving past the small string buffer also keeps the names in place when it is swapped.
+    explicit NameInterner(size_t capacity)
+    {
+        arena.reserve(std::max<size_t>(capacity, 64));
+    }
+
+    void intern(std::string_view& name)
+    {
+        auto iter = interned.find(name);
+        if (iter == interned.end())
+        {
+            size_t at = arena.size();
+            arena.append(name);
+            iter = interned.emplace(name, std::string_view(arena.data() + at, name.size())).first;
+        }
+        name = iter->second;
+    }
+};
+
+bool GameInterface::loadSymbolCache()
+{
+    MappedFile file;
+    if (!file.open(symbolCachePath)) return false;
+    MappedStream in = file.at(0);
+
+    if (get<uint32_t>(in) != SYMCACHE_MAGIC) return false;
+    if (get<uint32_t>(in) != SYMCACHE_VERSION) return false;
+
+    std::vector<FileKey> storedKeys, keys;
+    if (!getArray(in, storedKeys) || !fileKeys(level, keys) || storedKeys != keys) return false;
+
+    // Read into temporaries, so that nothing is changed unless the whole sidecar is valid.
+    struct Pointers { int32_t numTextures; RelocationTable table; };
+    std::vector<Pointers> pointers(level.size());
+    for (Pointers& p : pointers)
+    {
+        p.numTextures = get<int32_t>(in);
+        if (!getArray(in, p.table.keys) || !getArray(in, p.table.targets) || !getArray(in, p.table.files)) return false;
+        if (p.table.targets.size() != p.table.keys.size() || p.table.files.size() != p.table.keys.size()) return false;
+    }
+
+    std::vector<std::string_view> families, models, instances;
+    if (!getNames(in, families) || !getNames(in, models) || !getNames(in, instances)) return false;
+
+    uint32_t numActors = get<uint32_t>(in);
+    if (in.position > in.size || numActors > (in.size - in.position) / 20) return false;
+
+    std::vector<Actor> loaded(numActors);
+    for (Actor& actor : loaded)
+    {
+        actor.familyType = get<uint32_t>(in);
+        actor.modelType = get<uint32_t>(in);
+        actor.instanceType = get<uint32_t>(in);
+        actor.offset = get<uint32_t>(in);
+        actor.fileID = get<int32_t>(in);
+        if (!getList(in, actor.intelligenceList) || !getList(in, actor.reflexList) || !getList(in, actor.macroList)) return false;
+        if (actor.instanceType >= instances.size() || actor.fileID < 0 || size_t(actor.fileID) >= level.size()) return false;
+        actor.aiLoaded = true;
+    }
+
+    if (in.position != in.size) return false;
+
+    // The sidecar is unmapped on return, so the names are copied out of it.
+    NameInterner names(file.size);
+    for (std::vector<std::string_view>* list : { &families, &models, &instances })
+    {
+        for (std::string_view& name : *list) names.intern(name);
+    }
+
+    for (Actor& actor : loaded)
+    {
+        actor.name = instances[actor.instanceType];
+        for (Behavior& b : actor.intelligenceList) names.intern(b.name);
+        for (Behavior& b : actor.reflexList) names.intern(b.name);
+        for (Macro& m : actor.macroList) names.intern(m.name);
+    }
+
+    for (size_t i = 0; i < level.size(); i++)
+    {
+        level[i]->numTextures = pointers[i].numTextures;
+        level[i]->pointers = std::move(pointers[i].table);
+    }
+
+    familyNames.swap(families);
+    modelNames.swap(models);
+    instanceNames.swap(instances);
+    actors.swap(loaded);
+    nameArena.swap(names.arena);
+
+    return true;
+}
@@ -0,0 +1,94 @@
+//
+//  frontends.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-06-01.
+//
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <vector>
+
+#include "compile.hh"
+
+// Compiles every source in the given directories with both front ends, and fails if
+// any two trees differ. Actors and subroutines are resolved by the stubs below, so no
+// game data is needed: every name is found, at an address derived from the name.
+
+static uint32_t stubAddress(const char* name, uint32_t hash = 2166136261u)
+{
+    while (*name) hash = (hash ^ uint8_t(*name++)) * 16777619u;
+    return hash | 1;
+}
+
+static uint32_t findActor(const char* actorName)
+{
+    return stubAddress(actorName);
+}
+
+static uint32_t findSubroutine(const char* actorName, const char* macroName)
+{
+    return stubAddress(macroName, stubAddress(actorName));
+}
+
+int main(int argc, const char * argv[])
+{
+    if (argc < 2)
+    {
+        printf("usage: cpascpt-frontends [directory | sourcefile]...\n");
+        return -1;
+    }
+    
+    std::vector<std::filesystem::path> sources;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!std::filesystem::is_directory(argv[i]))
+        {
+            sources.push_back(argv[i]);
+            continue;
+        }
+        
+        for (const auto& entry : std::filesystem::directory_iterator(argv[i]))
+            if (entry.is_regular_file() && entry.path().extension() != ".cc") sources.push_back(entry.path());
+    }
+    std::sort(sources.begin(), sources.end());
+    
+    CompilerContext compiler(CompilerContext::Target::Target_R3_GC, CompilerContext::Options(0));
+    compiler.callbackFindActor = findActor;
+    compiler.callbackFindSubroutine = findSubroutine;
+    compiler.loadTables();
+    
+    size_t mismatched = 0;
+    for (const std::filesystem::path& path : sources)
+    {
+        std::ifstream file(path, std::ios_base::binary);
+        std::stringstream stream;
+        stream << file.rdbuf();
+        std::string source = stream.str();
+        
+        compiler.frontend = CompilerContext::Frontend_ANTLR;
+        compiler.nodetree.clear();
+        compiler.compile(source);
+        NodeTree antlrTree = compiler.nodetree;
+        bool antlrErrors = compiler.errorCount() != 0;
+        
+        compiler.frontend = CompilerContext::Frontend_Native;
+        compiler.nodetree.clear();
+        compiler.compile(source);
+        bool nativeErrors = compiler.errorCount() != 0;
+        
+        // Trees with errors are not compared, as the two parsers recover differently.
+        std::string mismatch;
+        if (antlrErrors != nativeErrors) mismatch = antlrErrors ? "only the ANTLR front end reported errors" : "only the native front end reported errors";
+        else if (!antlrErrors) mismatch = antlrTree.difference(compiler.nodetree);
+        
+        if (mismatch.empty()) continue;
+        fprintf(stderr, "%s: %s\n", path.string().c_str(), mismatch.c_str());
+        mismatched++;
+    }
+    
+    printf("%zu of %zu sources compiled differently\n", mismatched, sources.size());
+    return mismatched ? -1 : 0;
+}
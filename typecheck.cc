@@ -0,0 +1,336 @@
+//
+//  typecheck.cc
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-22.
+//
+
+#include "typecheck.hh"
+#include "symbols.hh"
+
+#include <algorithm>
+
+#pragma mark - R3
+
+struct FunctionSignature
+{
+    std::string_view name;
+    ValueType returnType;
+};
+
+// Return types of the R3 functions. Functions which are not listed return Type_Unknown.
+static constexpr FunctionSignature R3FunctionSignatures[] =
+{
+    // Vectors
+    { "GetPersoAbsolutePosition", Type_Vector },
+    { "GetMyAbsolutePosition", Type_Vector },
+    { "GetWPAbsolutePosition", Type_Vector },
+    { "CircularInterpolationBetween3WP", Type_Vector },
+    { "BezierBetween3WP", Type_Vector },
+    { "AbsoluteVector", Type_Vector },
+    { "RelativeVector", Type_Vector },
+    { "VecteurLocalToGlobal", Type_Vector },
+    { "VecteurGlobalToLocal", Type_Vector },
+    { "PAD2_GetGlobalVector", Type_Vector },
+    { "CrossProduct", Type_Vector },
+    { "Normalize", Type_Vector },
+    { "GetSPOCoordinates", Type_Vector },
+    { "GetSPOSighting", Type_Vector },
+    { "GetSPOHorizon", Type_Vector },
+    { "GetSPOBanking", Type_Vector },
+    { "GetPersoSighting", Type_Vector },
+    { "GetPersoHorizon", Type_Vector },
+    { "GetPersoBanking", Type_Vector },
+    { "LitPositionZDM", Type_Vector },
+    { "LitPositionZDE", Type_Vector },
+    { "LitPositionZDD", Type_Vector },
+    { "LitCentreZDM", Type_Vector },
+    { "LitCentreZDE", Type_Vector },
+    { "LitCentreZDD", Type_Vector },
+    { "LitAxeZDM", Type_Vector },
+    { "LitAxeZDE", Type_Vector },
+    { "LitAxeZDD", Type_Vector },
+    { "LitDimensionZDM", Type_Vector },
+    { "LitDimensionZDE", Type_Vector },
+    { "LitDimensionZDD", Type_Vector },
+    { "VecteurPointAxe", Type_Vector },
+    { "VecteurPointSegment", Type_Vector },
+    { "VectorContribution", Type_Vector },
+    { "VectorCombination", Type_Vector },
+    { "TemporalVectorCombination", Type_Vector },
+    { "ScaledVector", Type_Vector },
+    { "RotateVector", Type_Vector },
+    { "GetNormalCollideVector", Type_Vector },
+    { "GetNormalCollideVector2", Type_Vector },
+    { "GetNormalSlopeVector", Type_Vector },
+    { "GetCollidePoint", Type_Vector },
+    { "GetCollidePoint2", Type_Vector },
+    { "GetHandsCollidePoint", Type_Vector },
+    { "GetCollisionPoint", Type_Vector },
+    { "GetCollisionVector", Type_Vector },
+    { "GetColliderVector", Type_Vector },
+    { "ComputeRebondVector", Type_Vector },
+    { "GetModuleAbsolutePosition", Type_Vector },
+    { "GetModuleRelativePosition", Type_Vector },
+    { "GetModuleSighting", Type_Vector },
+    { "GetModuleHorizon", Type_Vector },
+    { "GetModuleBanking", Type_Vector },
+    { "GetOneCustomVector", Type_Vector },
+    { "Cam_GetShiftTarget", Type_Vector },
+    { "Cam_GetShiftPos", Type_Vector },
+    { "Cam_GetCurrentTargetPosition", Type_Vector },
+    { "Cam_GetBestPos", Type_Vector },
+
+    // Reals
+    { "GetAngleAroundZToPerso", Type_Real },
+    { "DistanceToPerso", Type_Real },
+    { "DistanceXToPerso", Type_Real },
+    { "DistanceYToPerso", Type_Real },
+    { "DistanceZToPerso", Type_Real },
+    { "DistanceXYToPerso", Type_Real },
+    { "DistanceXZToPerso", Type_Real },
+    { "DistanceYZToPerso", Type_Real },
+    { "DistanceToPersoCenter", Type_Real },
+    { "DistanceXToPersoCenter", Type_Real },
+    { "DistanceYToPersoCenter", Type_Real },
+    { "DistanceZToPersoCenter", Type_Real },
+    { "DistanceXYToPersoCenter", Type_Real },
+    { "DistanceXZToPersoCenter", Type_Real },
+    { "DistanceYZToPersoCenter", Type_Real },
+    { "GetRadiusWP", Type_Real },
+    { "DistanceToWP", Type_Real },
+    { "Real", Type_Real },
+    { "Sinus", Type_Real },
+    { "Cosinus", Type_Real },
+    { "Square", Type_Real },
+    { "SquareRoot", Type_Real },
+    { "RandomReal", Type_Real },
+    { "MinimumReal", Type_Real },
+    { "MaximumReal", Type_Real },
+    { "DegreeToRadian", Type_Real },
+    { "RadianToDegree", Type_Real },
+    { "AbsoluteValue", Type_Real },
+    { "LimitRealInRange", Type_Real },
+    { "Sign", Type_Real },
+    { "Cube", Type_Real },
+    { "Modulo", Type_Real },
+    { "TemporalRealCombination", Type_Real },
+    { "InputRealAnalogicValueX", Type_Real },
+    { "InputRealAnalogicValueY", Type_Real },
+    { "InputRealAnalogicValue", Type_Real },
+    { "PAD2_GetHorizontalAxis", Type_Real },
+    { "PAD2_GetVerticalAxis", Type_Real },
+    { "PAD2_GetAnalogForce", Type_Real },
+    { "PAD2_GetTrueAnalogForce", Type_Real },
+    { "PAD2_GetRotationAngle", Type_Real },
+    { "DotProduct", Type_Real },
+    { "GetVectorNorm", Type_Real },
+    { "VectorAngle", Type_Real },
+    { "VectorCos", Type_Real },
+    { "VectorSin", Type_Real },
+    { "VitesseHorizontaleDuPerso", Type_Real },
+    { "VitesseVerticaleDuPerso", Type_Real },
+    { "GetPersoZoomFactor", Type_Real },
+    { "GetModuleZoomFactor", Type_Real },
+    { "GetCollideRate", Type_Real },
+    { "GetCollideRate2", Type_Real },
+    { "GetColliderReal", Type_Real },
+    { "GetOneCustomFloat", Type_Real },
+
+    // Integers
+    { "Int", Type_Integer },
+    { "RandomInt", Type_Integer },
+    { "GetHitPoints", Type_Integer },
+    { "GetHitPointsMax", Type_Integer },
+    { "AddAndGetHitPoints", Type_Integer },
+    { "SubAndGetHitPoints", Type_Integer },
+    { "ListSize", Type_Integer },
+    { "GetNbFrame", Type_Integer },
+    { "GetOneCustomLong", Type_Integer },
+
+    // References
+    { "GivePersoInList", Type_Reference },
+    { "PersoLePlusProche", Type_Reference },
+    { "PersoLePlusProcheDansSecteurCourant", Type_Reference },
+    { "NearerActorInFieldOfVision", Type_Reference },
+    { "NearerActorOfFamilyInFieldOfVision", Type_Reference },
+    { "CibleLaPlusProche", Type_Reference },
+    { "CibleLaPlusProcheAvecAngles", Type_Reference },
+    { "GetCollisionPerso", Type_Reference },
+    { "GetColliderActor", Type_Reference },
+    { "GetLastCollisionActor", Type_Reference },
+    { "HierGetFather", Type_Reference },
+};
+
+static std::vector<ValueType> loadR3FunctionTypes()
+{
+    std::vector<ValueType> types(std::size(R3Functions), Type_Unknown);
+    for (const FunctionSignature& signature : R3FunctionSignatures)
+    {
+        const Symbol* symbol = R3SymbolIndex.find(signature.name);
+        if (symbol && symbol->table == SymbolTable_Function) types[symbol->index] = signature.returnType;
+    }
+    return types;
+}
+
+#pragma mark - Type check
+
+static bool isScalar(ValueType type)
+{
+    return type == Type_Integer || type == Type_Real;
+}
+
+// Whether evaluating the nodes in [begin, end) may change the state of the game.
+static bool hasSideEffects(const NodeTree& tree, uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++)
+    {
+        const Node& node = tree.nodes[i];
+        switch (node.type)
+        {
+            case NodeType::Function:
+            case NodeType::Procedure:
+            case NodeType::MetaAction:
+            case NodeType::SubRoutine:
+                return true;
+            case NodeType::Condition:
+                // Conditions past the operators are engine calls.
+                if (node.param >= 10) return true;
+                break;
+            case NodeType::Operator:
+                // Assignments
+                if ((node.param >= 6 && node.param <= 12) || node.param >= 22) return true;
+                break;
+        }
+    }
+    return false;
+}
+
+// Moves the second child of `node` in front of the first, with their subtrees.
+static void swapOperands(NodeTree& tree, const NodeTreeIndex& index, uint32_t node, size_t first, std::vector<ValueType>& types, std::vector<SourceLocation>& locations)
+{
+    uint32_t a = index.firstChild(node);
+    uint32_t b = index.nextSibling[a];
+    uint32_t end = index.end[b];
+
+    std::rotate(tree.nodes.begin() + a, tree.nodes.begin() + b, tree.nodes.begin() + end);
+    std::rotate(types.begin() + a, types.begin() + b, types.begin() + end);
+    std::rotate(locations.begin() + (a - first), locations.begin() + (b - first), locations.begin() + (end - first));
+}
+
+void typeCheck(CompilerContext& compiler, size_t first, std::vector<ValueType>& types)
+{
+    static const std::vector<ValueType> functionTypes = loadR3FunctionTypes();
+
+    NodeTree& tree = compiler.nodetree;
+    const NodeTreeIndex& index = tree.index();
+    types.assign(tree.nodes.size(), Type_Unknown);
+    compiler.nodeLocations.resize(tree.nodes.size() - first);
+
+    bool swapped = false;
+
+    // Children follow their parent, so walking backwards types every operand before its operator.
+    // Swapping operands only moves nodes within the subtree of the current node, which leaves
+    // the index valid for all nodes before it.
+    for (size_t i = tree.nodes.size(); i-- > first; )
+    {
+        Node& node = tree.nodes[i];
+        const SourceLocation& location = compiler.nodeLocations[i - first];
+        auto fail = [&](const std::string& reason) {
+            compiler.report(Diagnostic::Error, location.line, location.column, reason);
+        };
+
+        // Types of the first two children
+        uint32_t childA = index.firstChild(uint32_t(i));
+        uint32_t childB = childA != NodeTreeIndex::None ? index.nextSibling[childA] : NodeTreeIndex::None;
+        ValueType a = childA != NodeTreeIndex::None ? types[childA] : Type_Unknown;
+        ValueType b = childB != NodeTreeIndex::None ? types[childB] : Type_Unknown;
+        bool vectorA = a == Type_Vector, vectorB = b == Type_Vector;
+
+        ValueType& type = types[i];
+        switch (node.type)
+        {
+            case NodeType::Constant: type = Type_Integer; break;
+            case NodeType::Real: type = Type_Real; break;
+            case NodeType::String: type = Type_String; break;
+            case NodeType::Vector:
+            case NodeType::ConstantVector: type = Type_Vector; break;
+            case NodeType::ActorRef:
+            case NodeType::SuperObjectRef:
+            case NodeType::WayPointRef: type = Type_Reference; break;
+            case NodeType::Function: type = node.param < functionTypes.size() ? functionTypes[node.param] : Type_Unknown; break;
+
+            case NodeType::Condition:
+                type = Type_Boolean;
+                if (node.param <= 3 && (vectorA || vectorB)) fail("Attempt to perform logical operation on vector operand");
+                if (node.param >= 4 && node.param <= 9 && (vectorA || vectorB)) fail("Attempt to perform comparison on vector operand");
+                break;
+
+            case NodeType::Operator:
+                switch (node.param)
+                {
+                    case 0: // +
+                    case 1: // -
+                        if (!vectorA && !vectorB) break;
+                        if (isScalar(a) || isScalar(b))
+                        {
+                            fail(std::string("Cannot ") + (node.param == 0 ? "add" : "subtract") + " a vector and a scalar");
+                            break;
+                        }
+                        // The other operand is a vector, or is not known and presumed to be one.
+                        node.param = node.param == 0 ? 17 : 18;
+                        break;
+
+                    case 2: // *
+                        if (vectorA && vectorB)
+                        {
+                            fail("Cannot multiply two vectors: use DotProduct or CrossProduct");
+                            break;
+                        }
+                        if (!vectorA && !vectorB) break;
+                        // The vector operand comes first. Swapping the operands also swaps the order in
+                        // which they are evaluated, so operands with side effects are left in place, with
+                        // the scalar operator, as the game's own scripts have them.
+                        if (vectorB)
+                        {
+                            if (hasSideEffects(tree, childA, index.end[childB])) break;
+                            swapOperands(tree, index, uint32_t(i), first, types, compiler.nodeLocations);
+                            swapped = true;
+                        }
+                        node.param = 20;
+                        break;
+
+                    case 3: // /
+                        if (vectorB) fail("Cannot divide by a vector");
+                        else if (vectorA) node.param = 21;
+                        break;
+
+                    case 4: // Unary -
+                        if (vectorA) node.param = 19;
+                        break;
+
+                    case 5: // %
+                        if (vectorA || vectorB) fail("Modulo operation '%' cannot be performed on a vector operand");
+                        break;
+                }
+
+                switch (node.param)
+                {
+                    case 0: case 1: case 2: case 3: case 5:
+                        if (node.param == 2 && (vectorA || vectorB)) { type = Type_Vector; break; }
+                        type = (a == Type_Real || b == Type_Real) ? Type_Real : (a == Type_Integer && b == Type_Integer) ? Type_Integer : Type_Unknown;
+                        break;
+                    case 4: type = a; break;
+                    case 6: case 7: case 8: case 9: case 12: type = a; break; // Assignments
+                    case 13: // Field access; a.x is written as the component followed by the operand.
+                        type = (childA != NodeTreeIndex::None && tree.nodes[childA].type == NodeType::Operator && tree.nodes[childA].param >= 14 && tree.nodes[childA].param <= 16) ? Type_Real : b;
+                        break;
+                    case 14: case 15: case 16: type = Type_Real; break; // Vector components
+                    case 17: case 18: case 19: case 20: case 21: type = Type_Vector; break;
+                }
+                break;
+        }
+    }
+
+    if (swapped) tree.invalidate();
+}
@@ -0,0 +1,33 @@
+//
+//  typecheck.hh
+//  cpascpt
+//
+//  Created by Jba03 on 2023-05-22.
+//
+
+#ifndef typecheck_hh
+#define typecheck_hh
+
+#include <vector>
+
+#include "compile.hh"
+
+enum ValueType : uint8_t
+{
+    // Not known at compile time, e.g. a dsgvar
+    Type_Unknown,
+    Type_Integer,
+    Type_Real,
+    Type_Vector,
+    Type_Boolean,
+    // Actor, waypoint or other object of the level
+    Type_Reference,
+    Type_String,
+};
+
+// Infers the type of every node the compiler emitted from `first` onwards into `types`,
+// which is indexed by node. Arithmetic on vectors is given the vector operator codes,
+// and operations which are invalid on vectors are reported as errors.
+void typeCheck(CompilerContext& compiler, size_t first, std::vector<ValueType>& types);
+
+#endif /* typecheck_hh */
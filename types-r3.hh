@@ -8,7 +8,9 @@
 #ifndef types_r3_hh
 #define types_r3_hh
 
-static const std::vector<std::string> R3NodeTypes =
+#include <string_view>
+
+static constexpr std::string_view R3NodeTypes[] =
 {
     "KeyWord",
     "Condition",
@@ -57,7 +59,7 @@ static const std::vector<std::string> R3NodeTypes =
     "GraphRef",
 };
 
-static const std::vector<std::string> R3Keywords =
+static constexpr std::string_view R3Keywords[] =
 {
     "If", // 0
     "IfNot",
@@ -98,7 +100,7 @@ static const std::vector<std::string> R3Keywords =
     "EndWhile",
 };
 
-static const std::vector<std::string> R3Operators =
+static constexpr std::string_view R3Operators[] =
 {
     "Operator_Plus", // 0
     "Operator_Minus",
@@ -131,7 +133,7 @@ static const std::vector<std::string> R3Operators =
     "Operator_AffectArray"
 };
 
-static const std::vector<std::string> R3Functions = // TODO: Correct
+static constexpr std::string_view R3Functions[] = // TODO: Correct
 {
     "GetPersoAbsolutePosition",
     "GetMyAbsolutePosition",
@@ -581,7 +583,7 @@ static const std::vector<std::string> R3Functions = // TODO: Correct
     "FormatMc",
 };
 
-static const std::vector<std::string> R3Procedures = // TODO: Correct
+static constexpr std::string_view R3Procedures[] = // TODO: Correct
 {
     "SetHitPoints",
     "SetHitPointsInit",
@@ -1461,7 +1463,7 @@ static const std::vector<std::string> R3Procedures = // TODO: Correct
     "AllowNormalsRecomputing",
 };
 
-static const std::vector<std::string> R3Conditions =
+static constexpr std::string_view R3Conditions[] =
 {
     "Cond_And",
     "Cond_Or",
@@ -1643,7 +1645,7 @@ static const std::vector<std::string> R3Conditions =
     "SND_IsEventValid"
 };
 
-static const std::vector<std::string> R3Fields =
+static constexpr std::string_view R3Fields[] =
 {
     "Position",
     "Orientation",
@@ -1667,7 +1669,7 @@ static const std::vector<std::string> R3Fields =
     "SystemTime"
 };
 
-static const std::vector<std::string> R3MetaActions =
+static constexpr std::string_view R3MetaActions[] =
 {
     "TIME_FrozenWait",
     "ACTION_ExecuteAction",